@@ -0,0 +1,174 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "arm_alu.h"
+
+/* Checks the kernels of arm_alu.h against a model written after the pseudo
+ * code of the ARM manual, which computes in 64 bits. Usage:
+ *   alu_conformance [number of random operand pairs]
+ */
+
+#define DEFAULT_RANDOM_PAIRS 20000000ULL
+
+struct operation {
+    char *name;
+    int subtract;   /* a - b - NOT(carry_in) instead of a + b + carry_in */
+    int reverse;    /* operands swapped (RSB, RSC) */
+    int carry_in;   /* 0, 1 or -1 for the C flag */
+};
+
+static struct operation operations[] = {
+    { "ADD", 0, 0, 0 }, { "ADC", 0, 0, -1 }, { "CMN", 0, 0, 0 },
+    { "SUB", 1, 0, 1 }, { "SBC", 1, 0, -1 }, { "CMP", 1, 0, 1 },
+    { "RSB", 1, 1, 1 }, { "RSC", 1, 1, -1 }
+};
+#define OPERATIONS (sizeof(operations) / sizeof(operations[0]))
+
+static uint64_t failures = 0;
+
+static uint32_t model(int subtract, uint32_t a, uint32_t b, uint32_t c,
+                      uint32_t *carry, uint32_t *overflow) {
+    uint64_t unsigned_result;
+    int64_t signed_result;
+    uint32_t res;
+
+    if (subtract) {
+        /* C = NOT BorrowFrom(a - b - NOT(c)) */
+        unsigned_result = (uint64_t) a - b - !c;
+        signed_result = (int64_t) (int32_t) a - (int32_t) b - !c;
+        *carry = (uint64_t) a >= (uint64_t) b + !c;
+    } else {
+        /* C = CarryFrom(a + b + c) */
+        unsigned_result = (uint64_t) a + b + c;
+        signed_result = (int64_t) (int32_t) a + (int32_t) b + c;
+        *carry = unsigned_result > 0xFFFFFFFF;
+    }
+    res = (uint32_t) unsigned_result;
+    *overflow = signed_result != (int32_t) res;
+    return res;
+}
+
+static void check(struct operation *op, uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t res, carry, overflow, expected, expected_carry, expected_overflow;
+
+    if (op->reverse) {
+        uint32_t tmp = a;
+        a = b;
+        b = tmp;
+    }
+    if (op->carry_in >= 0)
+        c = op->carry_in;
+    if (op->subtract)
+        res = arm_alu_sub(a, b, c, &carry, &overflow);
+    else
+        res = arm_alu_add(a, b, c, &carry, &overflow);
+    expected = model(op->subtract, a, b, c, &expected_carry,
+                     &expected_overflow);
+    if ((res != expected) || (carry != expected_carry) ||
+        (overflow != expected_overflow)) {
+        if (failures++ < 10)
+            printf("%s %08X, %08X, C=%d: got %08X C=%d V=%d, expected %08X "
+                   "C=%d V=%d\n", op->name, a, b, c, res, carry, overflow,
+                   expected, expected_carry, expected_overflow);
+    }
+}
+
+static void check_all(uint32_t a, uint32_t b) {
+    int i;
+
+    for (i=0; i<OPERATIONS; i++) {
+        check(&operations[i], a, b, 0);
+        check(&operations[i], a, b, 1);
+    }
+}
+
+static void print_test(int result) {
+    if (result)
+        printf("Test succeded\n");
+    else
+        printf("TEST FAILED !!\n");
+}
+
+/* xorshift64*, enough to spread the operands over the whole range */
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_random() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t pairs = DEFAULT_RANDOM_PAIRS, i, before;
+    uint32_t edges[128], a, b;
+    struct timespec start, end;
+    double elapsed;
+    int j, k;
+
+    if (argc > 1)
+        pairs = strtoull(argv[1], NULL, 0);
+
+    printf("- powers of 2, their neighbours and their opposites, ");
+    for (k=0; k<32; k++) {
+        edges[4*k] = 1U << k;
+        edges[4*k+1] = (1U << k) - 1;
+        edges[4*k+2] = ~(1U << k);
+        edges[4*k+3] = -(1U << k);
+    }
+    before = failures;
+    for (j=0; j<128; j++)
+        for (k=0; k<128; k++)
+            check_all(edges[j], edges[k]);
+    print_test(failures == before);
+
+    printf("- all combinations of the 4 highest and 4 lowest bits, ");
+    before = failures;
+    for (j=0; j<256; j++)
+        for (k=0; k<256; k++) {
+            a = ((j & 0xF0) << 24) | (j & 0xF);
+            b = ((k & 0xF0) << 24) | (k & 0xF);
+            check_all(a, b);
+            check_all(a | 0x0FFFFFF0, b | 0x0FFFFFF0);
+        }
+    print_test(failures == before);
+
+    printf("- %llu random operand pairs, ", (unsigned long long) pairs);
+    fflush(stdout);
+    before = failures;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<pairs; i++) {
+        uint64_t r = next_random();
+
+        check_all(r, r >> 32);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    print_test(failures == before);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f million operations checked per second\n",
+           pairs * 2 * OPERATIONS / elapsed / 1e6);
+
+    return failures != 0;
+}
@@ -0,0 +1,55 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __ARM_ALU_H__
+#define __ARM_ALU_H__
+#include <stdint.h>
+
+/* Additions and subtractions of the ALU with their carry and overflow, see
+ * CarryFrom, BorrowFrom and OverflowFrom in the ARM manual (A2-4). They are
+ * computed from the sign bits of the operands and of the result, without
+ * branch nor loop.
+ * A subtraction a - b - NOT(carry_in) is the addition a + NOT(b) + carry_in,
+ * its carry out being NOT BorrowFrom. Thus:
+ *   ADD, CMN   arm_alu_add(a, b, 0)        ADC   arm_alu_add(a, b, C)
+ *   SUB, CMP   arm_alu_sub(a, b, 1)        SBC   arm_alu_sub(a, b, C)
+ *   RSB        arm_alu_sub(b, a, 1)        RSC   arm_alu_sub(b, a, C)
+ */
+static inline uint32_t arm_alu_add(uint32_t a, uint32_t b, uint32_t carry_in,
+                                   uint32_t *carry, uint32_t *overflow) {
+    uint32_t res = a + b + carry_in;
+
+    /* Carry out of bit 31: at least two of a[31], b[31] and the carry into
+     * bit 31, which is a[31] ^ b[31] ^ res[31]
+     */
+    *carry = ((a & b) | ((a | b) & ~res)) >> 31;
+    /* Operands of the same sign and result of the other sign */
+    *overflow = ((a ^ res) & (b ^ res)) >> 31;
+    return res;
+}
+
+static inline uint32_t arm_alu_sub(uint32_t a, uint32_t b, uint32_t carry_in,
+                                   uint32_t *carry, uint32_t *overflow) {
+    return arm_alu_add(a, ~b, carry_in, carry, overflow);
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <stdlib.h>
+#include "arm_block_cache.h"
+#include "memory.h"
+
+#define BLOCK_CACHE_SIZE 1024
+#define BLOCK_CACHE_INDEX(address) (((address) >> 2) & (BLOCK_CACHE_SIZE - 1))
+
+struct arm_block_cache_data {
+    arm_block blocks[BLOCK_CACHE_SIZE];
+};
+
+arm_block_cache arm_block_cache_create() {
+    arm_block_cache c;
+
+    c = malloc(sizeof(struct arm_block_cache_data));
+    if (c)
+        arm_block_cache_flush(c);
+    return c;
+}
+
+void arm_block_cache_destroy(arm_block_cache c) {
+    free(c);
+}
+
+arm_block *arm_block_cache_entry(arm_block_cache c, uint32_t address) {
+    arm_block *b = &c->blocks[BLOCK_CACHE_INDEX(address)];
+
+    if (!b->valid || (b->address != address)) {
+        b->address = address;
+        b->end = address;
+        b->valid = 0;
+        b->length = 0;
+        b->taken = NULL;
+        b->fall_through = NULL;
+        b->idle = 0;
+        b->hits = 0;
+        b->native = NULL;
+    }
+    return b;
+}
+
+/* Blocks are few and self modifying code is rare: we simply look for the
+ * blocks that overlap the written page.
+ */
+void arm_block_cache_invalidate_page(arm_block_cache c, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_SHIFT;
+    int i;
+
+    for (i=0; i<BLOCK_CACHE_SIZE; i++) {
+        arm_block *b = &c->blocks[i];
+        if (b->valid && ((b->address >> MEMORY_PAGE_SHIFT) <= page) &&
+            (((b->end - 1) >> MEMORY_PAGE_SHIFT) >= page))
+            b->valid = 0;
+    }
+}
+
+void arm_block_cache_flush(arm_block_cache c) {
+    int i;
+
+    for (i=0; i<BLOCK_CACHE_SIZE; i++) {
+        c->blocks[i].valid = 0;
+        c->blocks[i].address = 0;
+        c->blocks[i].length = 0;
+        c->blocks[i].native = NULL;
+    }
+}
@@ -0,0 +1,74 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __ARM_BLOCK_CACHE_H__
+#define __ARM_BLOCK_CACHE_H__
+#include <stdint.h>
+#include "arm_core.h"
+#include "arm_decode_cache.h"
+
+/* Cache of basic blocks. A block is a sequence of predecoded instructions that
+ * starts at address and ends either with an instruction that may change the
+ * pc (branch, write to r15, load of r15), just before an instruction that
+ * always raises an exception, or after ARM_BLOCK_MAX_LENGTH instructions.
+ * Blocks are linked to the block executed after them when their last
+ * instruction jumped (taken) or not (fall_through). A link is followed only if
+ * the pointed block is still valid and starts at the expected address, so
+ * that blocks can be dropped or replaced without updating their predecessors.
+ */
+#define ARM_BLOCK_MAX_LENGTH 32
+
+typedef struct arm_block arm_block;
+
+struct arm_block {
+    uint32_t address;
+    uint32_t end;       /* address following the last instruction */
+    int valid;
+    int length;
+    arm_block *taken;
+    arm_block *fall_through;
+    /* Loop on itself whose iterations all leave the core in the same state
+     * (see arm_block_idle in arm_instruction.c)
+     */
+    int idle;
+    /* Native translation of the block, see arm_jit.c */
+    uint32_t hits;
+    void *native;
+    uint8_t native_mode;
+    uint32_t native_generation;
+    arm_decoded_instruction ops[ARM_BLOCK_MAX_LENGTH];
+};
+
+typedef struct arm_block_cache_data *arm_block_cache;
+
+arm_block_cache arm_block_cache_create();
+void arm_block_cache_destroy(arm_block_cache c);
+
+/* Returns the block starting at address. If the cache held another block at
+ * its place, it is reset to an invalid block of length 0 starting at address,
+ * that the caller has to build.
+ */
+arm_block *arm_block_cache_entry(arm_block_cache c, uint32_t address);
+void arm_block_cache_invalidate_page(arm_block_cache c, uint32_t address);
+void arm_block_cache_flush(arm_block_cache c);
+
+#endif
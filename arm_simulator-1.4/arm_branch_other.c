@@ -46,7 +46,7 @@ int arm_coprocessor_others_swi(arm_core p, uint32_t ins) {
     if (get_bit(ins, 24)) {
         /* Here we implement the end of the simulation as swi 0x123456 */
         if ((ins & 0xFFFFFF) == 0x123456)
-            exit(0);
+            arm_exit(p, 0);
         return SOFTWARE_INTERRUPT;
     } 
     return UNDEFINED_INSTRUCTION;
@@ -105,3 +105,23 @@ int arm_miscellaneous(arm_core p, uint32_t ins) { //Reference à A4.1.38 et A4.1
 	
     return 0;
 }
+
+int arm_branch_exchange(arm_core p, uint32_t ins) { // BX et BLX (2), voir doc ARM A4.1.10 et A4.1.8
+	uint32_t target = arm_read_register(p, get_bits(ins, 3, 0));
+	uint32_t cpsr;
+
+	if(get_bit(ins, 5)) // BLX : LR contient l'adresse de l'instruction suivante
+		arm_write_register(p, 14, arm_read_register(p, 15) - 4);
+	cpsr = arm_read_cpsr(p); // Le bit 0 de l'adresse donne le jeu d'instructions (bit T du CPSR)
+	arm_write_cpsr(p, get_bit(target, 0) ? set_bit(cpsr, 5) : clr_bit(cpsr, 5));
+	arm_write_register(p, 15, target & 0xFFFFFFFE);
+	return 0;
+}
+
+int arm_count_leading_zeros(arm_core p, uint32_t ins) { // CLZ, voir doc ARM A4.1.13
+	uint32_t value = arm_read_register(p, get_bits(ins, 3, 0));
+
+	// __builtin_clz n'est pas défini pour 0
+	arm_write_register(p, get_bits(ins, 15, 12), value ? __builtin_clz(value) : 32);
+	return 0;
+}
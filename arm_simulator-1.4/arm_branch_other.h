@@ -28,5 +28,7 @@ Contact: Guillaume.Huard@imag.fr
 int arm_branch(arm_core p, uint32_t ins);
 int arm_coprocessor_others_swi(arm_core p, uint32_t ins);
 int arm_miscellaneous(arm_core p, uint32_t ins);
+int arm_branch_exchange(arm_core p, uint32_t ins);
+int arm_count_leading_zeros(arm_core p, uint32_t ins);
 
 #endif
@@ -27,28 +27,81 @@ Contact: Guillaume.Huard@imag.fr
 #include "arm_exception.h"
 #include "util.h"
 #include "trace.h"
+#include "arm_decode_cache.h"
+#include "arm_block_cache.h"
+#include "arm_data_processing.h"
 #include <stdlib.h>
+#include <pthread.h>
+
+struct arm_flags_record {
+    uint8_t pending;
+    uint8_t kind;
+    uint32_t a, b, res;
+};
 
 struct arm_core_data {
     uint32_t cycle_count;
+    struct arm_flags_record flags;
+    int last_exception;
+    int idle;
+    arm_exit_handler exit_handler;
+    volatile int stop_requests;
+    uint32_t stops_done;
+    pthread_mutex_t stop_lock;
+    pthread_cond_t stop_signal;
     registers reg;
     memory mem;
+    memory_tlb tlb;
+    arm_decode_cache decoded;
+    arm_block_cache blocks;
 };
 
+struct arm_snapshot_data {
+    registers reg;
+    uint32_t cycle_count;
+    uint32_t memory; /* identifies the snapshot of the memory */
+};
+
+/* Called by the memory when a page containing decoded instructions is written
+ */
+static void arm_code_modified(void *data, uint32_t address) {
+    arm_core p = (arm_core) data;
+
+    arm_decode_cache_invalidate_page(p->decoded, address);
+    arm_block_cache_invalidate_page(p->blocks, address);
+}
+
 arm_core arm_create(memory mem) {
     arm_core p;
 
     p = malloc(sizeof(struct arm_core_data));
     if (p) {
         p->mem = mem;
+        p->tlb = memory_get_tlb(mem);
 	p->reg = registers_create();
+        p->decoded = arm_decode_cache_create();
+        p->blocks = arm_block_cache_create();
+        memory_set_watch_handler(mem, arm_code_modified, p);
         arm_exception(p, RESET);
         p->cycle_count = 0;
+        p->flags.pending = 0;
+        p->last_exception = 0;
+        p->idle = 0;
+        p->exit_handler = NULL;
+        p->stop_requests = 0;
+        p->stops_done = 0;
+        pthread_mutex_init(&p->stop_lock, NULL);
+        pthread_cond_init(&p->stop_signal, NULL);
     }
     return p;
 }
 
 void arm_destroy(arm_core p) {
+    memory_set_watch_handler(p->mem, NULL, NULL);
+    arm_decode_cache_destroy(p->decoded);
+    arm_block_cache_destroy(p->blocks);
+    pthread_cond_destroy(&p->stop_signal);
+    pthread_mutex_destroy(&p->stop_lock);
     registers_destroy(p->reg);
     free(p);
 }
@@ -65,6 +118,197 @@ uint32_t arm_get_cycle_count(arm_core p) {
     return p->cycle_count;
 }
 
+/* Address of the next instruction to fetch and cpsr, these accesses are not
+ * traced
+ */
+uint32_t arm_get_pc(arm_core p) {
+    return read_register(p->reg, 15);
+}
+
+void arm_set_pc(arm_core p, uint32_t value) {
+    write_register(p->reg, 15, value);
+}
+
+/* Writes the flags of the recorded operation in the cpsr */
+static void arm_flush_flags(arm_core p) {
+    struct arm_flags_record *f = &p->flags;
+
+    if (f->pending) {
+        f->pending = 0;
+        write_cpsr(p->reg, arm_flags_evaluate(f->kind, f->a, f->b, f->res,
+                                              read_cpsr(p->reg)));
+    }
+}
+
+void arm_set_flags(arm_core p, uint8_t kind, uint32_t a, uint32_t b,
+                   uint32_t res) {
+    struct arm_flags_record *f = &p->flags;
+
+    /* C or V of the previous operation are kept */
+    if ((kind == ARM_FLAGS_LOGICAL) || (kind == ARM_FLAGS_CARRY))
+        arm_flush_flags(p);
+    f->pending = 1;
+    f->kind = kind;
+    f->a = a;
+    f->b = b;
+    f->res = res;
+}
+
+uint8_t arm_get_flags(arm_core p, int need_cv) {
+    struct arm_flags_record *f = &p->flags;
+
+    if (f->pending && !need_cv)
+        return ((f->res >> 28) & 8) | ((f->res == 0) << 2);
+    arm_flush_flags(p);
+    return read_cpsr(p->reg) >> 28;
+}
+
+uint32_t arm_get_cpsr(arm_core p) {
+    arm_flush_flags(p);
+    return read_cpsr(p->reg);
+}
+
+uint8_t arm_get_mode(arm_core p) {
+    return get_mode(p->reg);
+}
+
+/* Accounts for instructions executed without going through arm_fetch */
+void arm_add_cycles(arm_core p, uint32_t count) {
+    p->cycle_count += count;
+}
+
+/* Exception raised by the last instruction run by arm_run */
+int arm_get_last_exception(arm_core p) {
+    return p->last_exception;
+}
+
+void arm_set_last_exception(arm_core p, int exception) {
+    p->last_exception = exception;
+}
+
+void arm_set_exit_handler(arm_core p, arm_exit_handler handler) {
+    p->exit_handler = handler;
+}
+
+void arm_exit(arm_core p, int status) {
+    if (p->exit_handler)
+        p->exit_handler(p, status);
+    exit(status);
+}
+
+/* Asks arm_run to return as soon as possible, may be called from another
+ * thread than the one running the core (for instance to raise an irq). The
+ * request stays pending, and arm_run keeps returning ARM_RUN_STOP_REQUESTED,
+ * until the requester calls arm_stop_done once its work on the core has been
+ * applied: the thread running the core cannot consume it and go on before.
+ * arm_stop_requested only tells whether some request is pending.
+ * arm_get_stops_done counts the requests done so far and arm_wait_stops_done
+ * blocks until this count differs from done. Reading the count while holding
+ * the core, then releasing it and waiting, cannot miss a request done in
+ * between, and waits for the pending ones to be done.
+ */
+void arm_request_stop(arm_core p) {
+    pthread_mutex_lock(&p->stop_lock);
+    p->stop_requests++;
+    pthread_mutex_unlock(&p->stop_lock);
+}
+
+void arm_stop_done(arm_core p) {
+    pthread_mutex_lock(&p->stop_lock);
+    p->stop_requests--;
+    p->stops_done++;
+    pthread_cond_broadcast(&p->stop_signal);
+    pthread_mutex_unlock(&p->stop_lock);
+}
+
+int arm_stop_requested(arm_core p) {
+    return p->stop_requests != 0;
+}
+
+uint32_t arm_get_stops_done(arm_core p) {
+    uint32_t result;
+
+    pthread_mutex_lock(&p->stop_lock);
+    result = p->stops_done;
+    pthread_mutex_unlock(&p->stop_lock);
+    return result;
+}
+
+void arm_wait_stops_done(arm_core p, uint32_t done) {
+    pthread_mutex_lock(&p->stop_lock);
+    while (p->stops_done == done)
+        pthread_cond_wait(&p->stop_signal, &p->stop_lock);
+    pthread_mutex_unlock(&p->stop_lock);
+}
+
+/* Set by the execution engines when they leave the core at the start of an
+ * idle loop, after having run an iteration of it (see arm_run)
+ */
+void arm_set_idle(arm_core p, int idle) {
+    p->idle = idle;
+}
+
+int arm_is_idle(arm_core p) {
+    return p->idle;
+}
+
+/* Number of accesses made to memory mapped devices so far: an iteration of a
+ * loop that polls a device is not idle, since the device may change
+ */
+uint32_t arm_get_device_accesses(arm_core p) {
+    return memory_get_device_accesses(p->mem);
+}
+
+/* Location of the register file and index in it of the given register in the
+ * current mode. These give an untraced access to registers, used by the
+ * translated code of arm_jit.c. The flags are computed beforehand, so that
+ * the cpsr in the register file is up to date.
+ */
+uint32_t *arm_get_register_storage(arm_core p) {
+    arm_flush_flags(p);
+    return registers_storage(p->reg);
+}
+
+int arm_get_register_index(arm_core p, uint8_t reg) {
+    return registers_index(p->reg, reg);
+}
+
+arm_snapshot arm_core_snapshot(arm_core p) {
+    arm_snapshot snapshot = malloc(sizeof(struct arm_snapshot_data));
+
+    if (snapshot) {
+        snapshot->reg = registers_create();
+        if (snapshot->reg == NULL) {
+            free(snapshot);
+            return NULL;
+        }
+        arm_flush_flags(p);
+        registers_copy(snapshot->reg, p->reg);
+        snapshot->cycle_count = p->cycle_count;
+        snapshot->memory = memory_snapshot(p->mem);
+    }
+    return snapshot;
+}
+
+int arm_core_restore(arm_core p, arm_snapshot snapshot) {
+    /* The restored pages that hold decoded instructions are watched, the
+     * caches learn about them as for any other write
+     */
+    if (memory_restore(p->mem, snapshot->memory))
+        return -1;
+    registers_copy(p->reg, snapshot->reg);
+    p->flags.pending = 0;
+    p->cycle_count = snapshot->cycle_count;
+    p->last_exception = 0;
+    p->idle = 0;
+    return 0;
+}
+
+void arm_snapshot_destroy(arm_snapshot snapshot) {
+    registers_destroy(snapshot->reg);
+    free(snapshot);
+}
+
 /* In this implementation, the program counter is incremented during the fetch.
  * Thus, to meet the specification (see manual A2-9), we add 4 whenever the
  * value of the pc is read, so that instructions read their own address + 8 when
@@ -91,7 +335,10 @@ uint32_t arm_read_usr_register(arm_core p, uint8_t reg) {
 }
 
 uint32_t arm_read_cpsr(arm_core p) {
-    uint32_t value = read_cpsr(p->reg);
+    uint32_t value;
+
+    arm_flush_flags(p);
+    value = read_cpsr(p->reg);
     trace_register(p->cycle_count, READ, CPSR, 0, value);
     return value;
 }
@@ -113,6 +360,7 @@ void arm_write_usr_register(arm_core p, uint8_t reg, uint32_t value) {
 }
 
 void arm_write_cpsr(arm_core p, uint32_t value) {
+    p->flags.pending = 0;
     write_cpsr(p->reg, value);
     trace_register(p->cycle_count, WRITE, CPSR, 0, value);
 }
@@ -132,16 +380,67 @@ int arm_fetch(arm_core p, uint32_t *value) {
 
     p->cycle_count++;
     address = arm_read_register(p, 15) - 4;
-    result = memory_read_word(p->mem, address, value);
+    result = memory_tlb_read_word(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, address, *value);
     arm_write_register(p, 15, address + 4);
     return result;
 }
 
+/* Same as arm_fetch, except that the instruction is taken from the decode
+ * cache. When it is not already there, it is read using arm_read_code and the
+ * returned entry has a NULL handler: it must then be decoded.
+ */
+int arm_fetch_decoded(arm_core p, arm_decoded_instruction **decoded) {
+    int result = 0;
+    uint32_t address;
+    arm_decoded_instruction *d;
+
+    p->cycle_count++;
+    address = arm_read_register(p, 15) - 4;
+    d = arm_decode_cache_entry(p->decoded, address);
+    if (!d->handler)
+        result = arm_read_code(p, address, &d->ins);
+    trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, address, d->ins);
+    arm_write_register(p, 15, address + 4);
+    *decoded = d;
+    return result;
+}
+
+/* Accounts for the fetch of an instruction already decoded within a block:
+ * the pc and the trace evolve as if it had been fetched by arm_fetch.
+ */
+void arm_fetch_predecoded(arm_core p, arm_decoded_instruction *d) {
+    p->cycle_count++;
+    (void) arm_read_register(p, 15);
+    trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, d->address, d->ins);
+    arm_write_register(p, 15, d->address + 4);
+}
+
+/* Reads an instruction to decode it, without tracing. Its page is watched so
+ * that decoded copies of the instruction get dropped if it is overwritten.
+ */
+int arm_read_code(arm_core p, uint32_t address, uint32_t *value) {
+    int result;
+
+    result = memory_read_word(p->mem, address, value);
+    if (!result)
+        memory_watch_page(p->mem, address);
+    return result;
+}
+
+/* Entry of the decode cache for address, see arm_decode_cache_entry */
+arm_decoded_instruction *arm_get_decoded(arm_core p, uint32_t address) {
+    return arm_decode_cache_entry(p->decoded, address);
+}
+
+arm_block *arm_get_block(arm_core p, uint32_t address) {
+    return arm_block_cache_entry(p->blocks, address);
+}
+
 int arm_read_byte(arm_core p, uint32_t address, uint8_t *value) {
     int result;
 
-    result = memory_read_byte(p->mem, address, value);
+    result = memory_tlb_read_byte(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, READ, 1, OTHER_ACCESS, address, *value);
     return result;
 }
@@ -152,7 +451,7 @@ int arm_read_byte(arm_core p, uint32_t address, uint8_t *value) {
 int arm_read_half(arm_core p, uint32_t address, uint16_t *value) {
     int result;
 
-    result = memory_read_half(p->mem, address, value);
+    result = memory_tlb_read_half(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, READ, 2, OTHER_ACCESS, address, *value);
     return result;
 }
@@ -160,7 +459,7 @@ int arm_read_half(arm_core p, uint32_t address, uint16_t *value) {
 int arm_read_word(arm_core p, uint32_t address, uint32_t *value) {
     int result;
 
-    result = memory_read_word(p->mem, address, value);
+    result = memory_tlb_read_word(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, READ, 4, OTHER_ACCESS, address, *value);
     return result;
 }
@@ -168,7 +467,7 @@ int arm_read_word(arm_core p, uint32_t address, uint32_t *value) {
 int arm_write_byte(arm_core p, uint32_t address, uint8_t value) {
     int result;
 
-    result = memory_write_byte(p->mem, address, value);
+    result = memory_tlb_write_byte(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, WRITE, 1, OTHER_ACCESS, address, value);
     return result;
 }
@@ -176,7 +475,7 @@ int arm_write_byte(arm_core p, uint32_t address, uint8_t value) {
 int arm_write_half(arm_core p, uint32_t address, uint16_t value) {
     int result;
 
-    result = memory_write_half(p->mem, address, value);
+    result = memory_tlb_write_half(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, WRITE, 2, OTHER_ACCESS, address, value);
     return result;
 }
@@ -184,11 +483,33 @@ int arm_write_half(arm_core p, uint32_t address, uint16_t value) {
 int arm_write_word(arm_core p, uint32_t address, uint32_t value) {
     int result;
 
-    result = memory_write_word(p->mem, address, value);
+    result = memory_tlb_write_word(p->tlb, p->mem, address, value);
     trace_memory(p->cycle_count, WRITE, 4, OTHER_ACCESS, address, value);
     return result;
 }
 
+int arm_read_words(arm_core p, uint32_t address, uint32_t *values, int count) {
+    int result, i;
+
+    result = memory_read_words(p->mem, address, values, count);
+    if (!result && trace_has(MEMORY))
+        for (i = 0; i < count; i++)
+            trace_memory_access(p->cycle_count, READ, 4, OTHER_ACCESS,
+                                address + 4 * i, values[i]);
+    return result;
+}
+
+int arm_write_words(arm_core p, uint32_t address, uint32_t *values, int count) {
+    int result, i;
+
+    result = memory_write_words(p->mem, address, values, count);
+    if (!result && trace_has(MEMORY))
+        for (i = 0; i < count; i++)
+            trace_memory_access(p->cycle_count, WRITE, 4, OTHER_ACCESS,
+                                address + 4 * i, values[i]);
+    return result;
+}
+
 void arm_print_state(arm_core p, FILE *out) {
     int mode, reg, count;
 
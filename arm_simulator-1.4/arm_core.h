@@ -28,15 +28,68 @@ Contact: Guillaume.Huard@imag.fr
 #include "memory.h"
 
 typedef struct arm_core_data *arm_core;
+typedef struct arm_decoded_instruction arm_decoded_instruction;
+typedef struct arm_block arm_block;
 
 void arm_init();
 arm_core arm_create(memory mem);
 void arm_destroy(arm_core p);
 void arm_print_state(arm_core p, FILE *out);
 
+/* Snapshot of the whole machine: the registers of all the modes, the cycle
+ * count and the memory (see memory_snapshot, which tells what it costs).
+ * arm_core_restore brings the core and its memory back to the snapshot and
+ * can be called any number of times. Taking a snapshot makes the previous
+ * ones of the same memory unusable: restoring them returns -1.
+ */
+typedef struct arm_snapshot_data *arm_snapshot;
+
+arm_snapshot arm_core_snapshot(arm_core p);
+int arm_core_restore(arm_core p, arm_snapshot snapshot);
+void arm_snapshot_destroy(arm_snapshot snapshot);
+
 int arm_current_mode_has_spsr(arm_core p);
 int arm_in_a_privileged_mode(arm_core p);
 uint32_t arm_get_cycle_count(arm_core p);
+uint32_t arm_get_pc(arm_core p);
+void arm_set_pc(arm_core p, uint32_t value);
+uint32_t arm_get_cpsr(arm_core p);
+uint8_t arm_get_mode(arm_core p);
+void arm_add_cycles(arm_core p, uint32_t count);
+int arm_get_last_exception(arm_core p);
+void arm_set_last_exception(arm_core p, int exception);
+/* End of the simulation asked by the guest (swi 0x123456, see also the
+ * sysctl device): arm_exit calls the handler given to arm_set_exit_handler,
+ * if any, then exits the simulator with status
+ */
+typedef void (*arm_exit_handler)(arm_core p, int status);
+void arm_set_exit_handler(arm_core p, arm_exit_handler handler);
+void arm_exit(arm_core p, int status);
+void arm_request_stop(arm_core p);
+void arm_stop_done(arm_core p);
+int arm_stop_requested(arm_core p);
+uint32_t arm_get_stops_done(arm_core p);
+void arm_wait_stops_done(arm_core p, uint32_t done);
+void arm_set_idle(arm_core p, int idle);
+int arm_is_idle(arm_core p);
+uint32_t arm_get_device_accesses(arm_core p);
+uint32_t *arm_get_register_storage(arm_core p);
+int arm_get_register_index(arm_core p, uint8_t reg);
+
+/* Lazy evaluation of the flags: an instruction that sets the flags records
+ * its kind, its operands and its result. The flags are only computed when the
+ * cpsr is read (which includes arm_get_cpsr and arm_get_register_storage) or
+ * by arm_get_flags, and dropped when the cpsr is written.
+ */
+#define ARM_FLAGS_LOGICAL 0 /* N and Z from res, C and V unchanged */
+#define ARM_FLAGS_ADD     1 /* res = a + b */
+#define ARM_FLAGS_SUB     2 /* res = a - b */
+#define ARM_FLAGS_GIVEN   3 /* N and Z from res, C in a and V in b */
+#define ARM_FLAGS_CARRY   4 /* N and Z from res, C in a and V unchanged */
+void arm_set_flags(arm_core p, uint8_t kind, uint32_t a, uint32_t b,
+                   uint32_t res);
+/* Returns NZCV in the 4 low bits, C and V are meaningful only if need_cv */
+uint8_t arm_get_flags(arm_core p, int need_cv);
 
 uint32_t arm_read_register(arm_core p, uint8_t reg);
 uint32_t arm_read_usr_register(arm_core p, uint8_t reg);
@@ -48,12 +101,20 @@ void arm_write_cpsr(arm_core p, uint32_t value);
 void arm_write_spsr(arm_core p, uint32_t value);
 
 int arm_fetch(arm_core p, uint32_t *value);
+int arm_fetch_decoded(arm_core p, arm_decoded_instruction **decoded);
+void arm_fetch_predecoded(arm_core p, arm_decoded_instruction *d);
+int arm_read_code(arm_core p, uint32_t address, uint32_t *value);
+arm_decoded_instruction *arm_get_decoded(arm_core p, uint32_t address);
+arm_block *arm_get_block(arm_core p, uint32_t address);
 int arm_read_byte(arm_core p, uint32_t address, uint8_t *value);
 int arm_read_half(arm_core p, uint32_t address, uint16_t *value);
 int arm_read_word(arm_core p, uint32_t address, uint32_t *value);
 int arm_write_byte(arm_core p, uint32_t address, uint8_t value);
 int arm_write_half(arm_core p, uint32_t address, uint16_t value);
 int arm_write_word(arm_core p, uint32_t address, uint32_t value);
+/* Block transfers of count words, traced as count word accesses */
+int arm_read_words(arm_core p, uint32_t address, uint32_t *values, int count);
+int arm_write_words(arm_core p, uint32_t address, uint32_t *values, int count);
 
 #include "trace_location.h"
 #endif
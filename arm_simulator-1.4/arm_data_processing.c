@@ -21,276 +21,321 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hères
 */
 #include "arm_data_processing.h"
+#include "arm_alu.h"
 #include "arm_exception.h"
 #include "arm_constants.h"
 #include "arm_branch_other.h"
 #include "util.h"
+#include "trace.h"
 #include "debug.h"
 
-#include <string.h>
+// Calcul des flags ZNCV d'une opération, voir arm_set_flags dans arm_core.h
+uint32_t arm_flags_evaluate(uint8_t kind, uint32_t a, uint32_t b, uint32_t res, uint32_t cpsr) {
+	int zFlag = res == 0;
+	int nFlag = get_bit(res, 31);
+	int cFlag = get_bit(cpsr, C);
+	int vFlag = get_bit(cpsr, V);
 
-// Calcul de la dernière retenue ou du dernier emprunt si soustraction (flag C)
-int getCarryFlag(uint32_t left, uint32_t right, char operand) { 
-	int cFlag = 0;
+	uint32_t carry, overflow;
 
-	for(int i = 0 ; i < 31 ; i++) {
-		int leftBit = get_bit(left, i);
-		int rightBit = get_bit(right, i);
+	switch(kind) {
+		case ARM_FLAGS_ADD:
+			arm_alu_add(a, b, 0, &carry, &overflow);
+			cFlag = carry;
+			vFlag = overflow;
+			break;
+		case ARM_FLAGS_SUB:
+			arm_alu_sub(a, b, 1, &carry, &overflow);
+			cFlag = carry;
+			vFlag = overflow;
+			break;
+		case ARM_FLAGS_GIVEN:
+			cFlag = a;
+			vFlag = b;
+			break;
+		case ARM_FLAGS_CARRY:
+			cFlag = a;
+			break;
+	}
 
-		int res = leftBit + (operand=='+' ? rightBit+cFlag : -rightBit-cFlag);
+	int t[4][2] = { { zFlag, Z }, { nFlag, N }, { cFlag, C }, { vFlag, V } };
 
-		if(operand == '+' && res > 1) {
-			cFlag = 1;
-			res -= 2;
-		} else if(operand == '-' && (res == 2 || res == -1)) {
-			cFlag = 1;
-			res = res == 2 ? 0 : 1;
-		} else {
-			cFlag = 0;
-		}
+	for(int i=0; i < 4; i++) {
+		cpsr = t[i][0]? set_bit(cpsr, t[i][1]) : clr_bit(cpsr, t[i][1]);
 	}
-	
-	return cFlag;
+	return cpsr;
 }
 
-int getCarryFlagAdd(uint32_t left, uint32_t right) {
-	return getCarryFlag(left, right, '+');
-}
+#if defined(__GNUC__)
+#define ARM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ARM_ALWAYS_INLINE inline
+#endif
 
-int getCarryFlagSub(uint32_t left, uint32_t right) {
-	return getCarryFlag(left, right, '-');
-}
+/* Formes de l'opérande de décalage (shifter operand, voir doc ARM A5.1). Après l'immédiat, la
+ * forme vaut 1 + les bits 6-4 de l'instruction : type de décalage et décalage par un registre.
+ */
+#define ARM_SHIFTER_IMMEDIATE     0
+#define ARM_SHIFTER_LSL_IMMEDIATE 1
+#define ARM_SHIFTER_LSL_REGISTER  2
+#define ARM_SHIFTER_LSR_IMMEDIATE 3
+#define ARM_SHIFTER_LSR_REGISTER  4
+#define ARM_SHIFTER_ASR_IMMEDIATE 5
+#define ARM_SHIFTER_ASR_REGISTER  6
+#define ARM_SHIFTER_ROR_IMMEDIATE 7
+#define ARM_SHIFTER_ROR_REGISTER  8
+#define ARM_SHIFTER_FORMS         9
 
-//Calcul du flag V
-int getOverflowFlag(int res, int a, int b, char operand) {
-	int leftBit = get_bit(a, 31);
-	int rightBit = get_bit(b, 31);
+// Retenue sortie du décalage quand le flag C n'est pas modifié
+#define ARM_CARRY_UNCHANGED 2
 
-	return
-		operand == '+' ?
-			rightBit == leftBit && rightBit != get_bit(res, 31) :
-		operand == '-' ?
-			rightBit != leftBit && rightBit != get_bit(res, 31) :
-		0;
+static uint32_t arm_carry(arm_core p) {
+	return (arm_get_flags(p, 1) >> 1) & 1;
 }
 
-int getOverflowFlagAdd(int res, int a, int b) {
-	return getOverflowFlag(res, a, b, '+');
-}
+/* Calcul de l'opérande de décalage et de sa retenue (shifter_carry_out), voir doc ARM A5.1.2 à A5.1.13.
+ * rm est la valeur de Rm, lue par l'appelant.
+ */
+static ARM_ALWAYS_INLINE uint32_t arm_shifter_operand(arm_core p, arm_decoded_instruction *d, int form,
+                                                      uint32_t rm, int *carry) {
+	uint32_t n = d->shift_imm;
 
-int getOverflowFlagSub(int res, int a, int b) {
-	return getOverflowFlag(res, a, b, '-');
-}
+	switch(form) {
+		case ARM_SHIFTER_IMMEDIATE:
+			*carry = d->rs == 0 ? ARM_CARRY_UNCHANGED : get_bit(d->immediate, 31); // rotate_imm nul
+			return d->immediate;
+		case ARM_SHIFTER_LSL_IMMEDIATE:
+			if(n == 0) {
+				*carry = ARM_CARRY_UNCHANGED;
+				return rm;
+			}
+			*carry = get_bit(rm, 32 - n);
+			return rm << n;
+		case ARM_SHIFTER_LSR_IMMEDIATE:
+			if(n == 0) { // LSR #32
+				*carry = get_bit(rm, 31);
+				return 0;
+			}
+			*carry = get_bit(rm, n - 1);
+			return rm >> n;
+		case ARM_SHIFTER_ASR_IMMEDIATE:
+			if(n == 0) { // ASR #32
+				*carry = get_bit(rm, 31);
+				return *carry ? 0xFFFFFFFF : 0;
+			}
+			*carry = get_bit(rm, n - 1);
+			return asr(rm, n);
+		case ARM_SHIFTER_ROR_IMMEDIATE:
+			if(n == 0) { // RRX
+				*carry = get_bit(rm, 0);
+				return (arm_carry(p) << 31) | (rm >> 1);
+			}
+			*carry = get_bit(rm, n - 1);
+			return ror(rm, n);
+	}
 
-// Mise à jour des variables pour les instructions qui modifient uniquement les flags ZNCV
-void updateForTest(int* updateCPSR, int* write_register) {
-	*updateCPSR = 1;
-	*write_register = 0;
+	// Décalage par l'octet de poids faible de Rs
+	n = arm_read_register(p, d->rs) & 0xFF;
+	if(n == 0) {
+		*carry = ARM_CARRY_UNCHANGED;
+		return rm;
+	}
+	switch(form) {
+		case ARM_SHIFTER_LSL_REGISTER:
+			if(n < 32) {
+				*carry = get_bit(rm, 32 - n);
+				return rm << n;
+			}
+			*carry = n == 32 ? get_bit(rm, 0) : 0;
+			return 0;
+		case ARM_SHIFTER_LSR_REGISTER:
+			if(n < 32) {
+				*carry = get_bit(rm, n - 1);
+				return rm >> n;
+			}
+			*carry = n == 32 ? get_bit(rm, 31) : 0;
+			return 0;
+		case ARM_SHIFTER_ASR_REGISTER:
+			if(n < 32) {
+				*carry = get_bit(rm, n - 1);
+				return asr(rm, n);
+			}
+			*carry = get_bit(rm, 31);
+			return *carry ? 0xFFFFFFFF : 0;
+		default: // ARM_SHIFTER_ROR_REGISTER
+			n &= 31;
+			if(n == 0) {
+				*carry = get_bit(rm, 31);
+				return rm;
+			}
+			*carry = get_bit(rm, n - 1);
+			return ror(rm, n);
+	}
 }
 
-// Exécution de l'instruction
-int executeInst(int opcode, arm_core p, int rd, uint32_t valueRn, uint32_t shifter_operand, int updateCPSR) {
-	int valueCpsr = arm_read_cpsr(p);
-	int zFlag = get_bit(valueCpsr, Z);
-	int nFlag = get_bit(valueCpsr, N);
-	int cFlag = get_bit(valueCpsr, C);
-	int vFlag = get_bit(valueCpsr, V);
-	uint32_t res;
-	int write_register = 1;
-	int oldcFlag;
-	
+/* Exécution d'un traitement de données, voir doc ARM A4.1. opcode, form et s sont des constantes
+ * dans chacun des handlers générés plus bas : le compilateur ne garde que le code de leur cas.
+ */
+static ARM_ALWAYS_INLINE int arm_data_processing(arm_core p, arm_decoded_instruction *d, int opcode, int form, int s) {
+	// Sans trace des registres, le calcul des flags est laissé au processeur qui ne les évalue qu'à la demande.
+	// Seules ADC, SBC et RSC lisent alors le CPSR, pour la retenue.
+	int lazy = !trace_has(REGISTERS);
+	int test = opcode >= 0b1000 && opcode <= 0b1011; // TST, TEQ, CMP et CMN ne modifient que les flags
+	uint32_t valueRm = form == ARM_SHIFTER_IMMEDIATE ? 0 : arm_read_register(p, d->rm);
+	uint32_t valueRn = arm_read_register(p, d->rn); // Lu même par MOV et MVN, ce qui apparaît dans la trace
+	uint32_t shifter_operand, res, cpsr = 0, a = 0, b = 0;
+	int carry, kind = ARM_FLAGS_LOGICAL; // Façon de calculer les flags C et V, à partir des opérandes a et b
+	int cFlag;
+
+	shifter_operand = arm_shifter_operand(p, d, form, valueRm, &carry);
+	if(!lazy)
+		cpsr = arm_read_cpsr(p);
+	else if(opcode >= 0b0101 && opcode <= 0b0111)
+		cpsr = arm_carry(p) << C;
+	cFlag = get_bit(cpsr, C);
+
 	switch(opcode) {
 		case 0b0000: // AND
-			res = valueRn && shifter_operand;
+		case 0b1000: // TST
+			res = valueRn & shifter_operand;
 			break;
 		case 0b0001: // EOR
-			res = (valueRn || shifter_operand) && !(valueRn && shifter_operand);
+		case 0b1001: // TEQ
+			res = valueRn ^ shifter_operand;
 			break;
 		case 0b0010: // SUB
+		case 0b1010: // CMP
 			res = valueRn - shifter_operand;
-			cFlag = getCarryFlagSub(valueRn, shifter_operand);
-			vFlag = getOverflowFlagSub(res, valueRn, shifter_operand);
+			kind = ARM_FLAGS_SUB; a = valueRn; b = shifter_operand;
 			break;
 		case 0b0011: // RSB
 			res = shifter_operand - valueRn;
-			cFlag = getCarryFlagSub(shifter_operand, valueRn);
-			vFlag = getOverflowFlagSub(res, shifter_operand, valueRn);
+			kind = ARM_FLAGS_SUB; a = shifter_operand; b = valueRn;
 			break;
 		case 0b0100: // ADD
+		case 0b1011: // CMN
 			res = shifter_operand + valueRn;
-			cFlag = getCarryFlagAdd(shifter_operand, valueRn);
-			vFlag = getOverflowFlagAdd(res, shifter_operand, valueRn);
+			kind = ARM_FLAGS_ADD; a = shifter_operand; b = valueRn;
 			break;
 		case 0b0101: // ADC
-			res = shifter_operand + valueRn + cFlag;
-			oldcFlag = cFlag;
-			cFlag = getCarryFlagAdd(shifter_operand, valueRn);
-			if(!cFlag && oldcFlag) {
-				cFlag = getCarryFlagAdd(shifter_operand + valueRn, 1);
-			}
-			vFlag = getOverflowFlagAdd(shifter_operand + valueRn, shifter_operand, valueRn);
-			if(!vFlag && oldcFlag) {
-				vFlag = getOverflowFlagAdd(res, valueRn + shifter_operand, 1);
-			}
+			res = arm_alu_add(valueRn, shifter_operand, cFlag, &a, &b);
+			kind = ARM_FLAGS_GIVEN;
 			break;
 		case 0b0110: // SBC
-			res = valueRn - shifter_operand - (~cFlag);
-			oldcFlag = cFlag;
-			cFlag = getCarryFlagSub(valueRn, shifter_operand);
-			if(!cFlag && !oldcFlag) {
-				cFlag = getCarryFlagSub(valueRn - shifter_operand, 1);
-			}
-			vFlag = getOverflowFlagSub(valueRn - shifter_operand, valueRn, shifter_operand);
-			if(!vFlag && !oldcFlag) {
-				vFlag = getOverflowFlagSub(res, valueRn - shifter_operand, 1);
-			}
+			res = arm_alu_sub(valueRn, shifter_operand, cFlag, &a, &b);
+			kind = ARM_FLAGS_GIVEN;
 			break;
 		case 0b0111: // RSC
-			res = shifter_operand - valueRn - (~cFlag);
-			oldcFlag = cFlag;
-			cFlag = getCarryFlagSub(shifter_operand, valueRn);
-			if(!cFlag && !oldcFlag) {
-				cFlag = getCarryFlagSub(shifter_operand - valueRn, 1);
-			}
-			vFlag = getOverflowFlagSub(shifter_operand - valueRn, shifter_operand, valueRn);
-			if(!vFlag && !oldcFlag) {
-				vFlag = getOverflowFlagSub(res, shifter_operand - valueRn, 1);
-			}
-			break;
-		case 0b1000: // TST
-			res = valueRn && shifter_operand;
-			updateForTest(&updateCPSR, &write_register); // On modifie seulement les flags ZNCV
-			break;
-		case 0b1001: // TEQ
-			res = (valueRn || shifter_operand) && !(valueRn && shifter_operand);
-			updateForTest(&updateCPSR, &write_register);
-			break;
-		case 0b1010: // CMP
-			res = valueRn - shifter_operand;
-			updateForTest(&updateCPSR, &write_register);
-			cFlag = getCarryFlagSub(valueRn, shifter_operand);
-			vFlag = getOverflowFlagSub(res, valueRn, shifter_operand);
-			break;
-		case 0b1011: // CMN
-			res = valueRn + shifter_operand;
-			updateForTest(&updateCPSR, &write_register);
-			cFlag = getCarryFlagAdd(shifter_operand, valueRn);
-			vFlag = getOverflowFlagAdd(res, valueRn, shifter_operand);
+			res = arm_alu_sub(shifter_operand, valueRn, cFlag, &a, &b);
+			kind = ARM_FLAGS_GIVEN;
 			break;
 		case 0b1100: // ORR
-			res = valueRn || shifter_operand;
+			res = valueRn | shifter_operand;
 			break;
 		case 0b1101: // MOV
 			res = shifter_operand;
 			break;
 		case 0b1110: // BIC
-			res = valueRn && (~shifter_operand);
+			res = valueRn & ~shifter_operand;
 			break;
-		case 0b1111: // MVN
+		default: // MVN
 			res = ~shifter_operand;
 			break;
-		default:
-			return UNDEFINED_INSTRUCTION;
 	}
-	
-	zFlag = res == 0;
-	nFlag = get_bit(res, 31);
-	
-	if(write_register) 
-		arm_write_register(p, rd, res);
-	
-	int t[4][2] = { { zFlag, Z }, { nFlag, N }, { cFlag, C }, { vFlag, V } };
+	// Les opérations logiques prennent la retenue du décalage
+	if(kind == ARM_FLAGS_LOGICAL && carry != ARM_CARRY_UNCHANGED) {
+		kind = ARM_FLAGS_CARRY; a = carry;
+	}
 
-	if(updateCPSR) {
-		if(write_register && rd == 15) { // voir doc ARM A4-5 | write_register permet de vérifier qu'on est bien dans une instruction qui ne modifie pas seulement les flags ZNCV
+	if(!test)
+		arm_write_register(p, d->rd, res);
+
+	if(s || test) {
+		if(!test && d->rd == 15) { // voir doc ARM A4-5
 			if(arm_current_mode_has_spsr(p))
 				arm_write_cpsr(p, arm_read_spsr(p));
 		}
+		else if(lazy) {
+			arm_set_flags(p, kind, a, b, res);
+		}
 		else {
-			for(int i=0; i < 4; i++) {
-				valueCpsr = t[i][0]? set_bit(valueCpsr, t[i][1]) : clr_bit(valueCpsr, t[i][1]);
-			}
-
-			arm_write_cpsr(p, valueCpsr);
+			arm_write_cpsr(p, arm_flags_evaluate(kind, a, b, res, cpsr));
 		}
 	}
-	
 	return 0;
 }
 
-// On effectue l'opération lsl, lsr, asr ou ror
-int getShifterOperand(int so, int si, char* operand) {
-	char* operands[4] = { "lsl", "lsr", "asr", "ror" };
-	
-	int k = -1;
-
-	for(int i=0; i < 4; i++) {
-		if(strcmp(operands[i], operand) == 0) {
-			k = i;
-		}
+/* Un handler par opcode, forme de l'opérande de décalage et bit S : arm_dp_<opcode>_<forme>_<s> */
+#define ARM_DP_HANDLER(opcode, form, s) \
+	static int arm_dp_##opcode##_##form##_##s(arm_core p, arm_decoded_instruction *d) { \
+		return arm_data_processing(p, d, opcode, form, s); \
 	}
+#define ARM_DP_HANDLERS_FORM(opcode, form) ARM_DP_HANDLER(opcode, form, 0) ARM_DP_HANDLER(opcode, form, 1)
+#define ARM_DP_HANDLERS(opcode) \
+	ARM_DP_HANDLERS_FORM(opcode, 0) ARM_DP_HANDLERS_FORM(opcode, 1) ARM_DP_HANDLERS_FORM(opcode, 2) \
+	ARM_DP_HANDLERS_FORM(opcode, 3) ARM_DP_HANDLERS_FORM(opcode, 4) ARM_DP_HANDLERS_FORM(opcode, 5) \
+	ARM_DP_HANDLERS_FORM(opcode, 6) ARM_DP_HANDLERS_FORM(opcode, 7) ARM_DP_HANDLERS_FORM(opcode, 8)
 
-	if(si > 0) {
-		switch(k) {
-			case 0: so = so << si; break;
-			case 1: so = so >> si; break;
-			case 2: so = asr(so, si); break;
-			case 3: so = ror(so, si);
-		}
-	}
+ARM_DP_HANDLERS(0) ARM_DP_HANDLERS(1) ARM_DP_HANDLERS(2) ARM_DP_HANDLERS(3)
+ARM_DP_HANDLERS(4) ARM_DP_HANDLERS(5) ARM_DP_HANDLERS(6) ARM_DP_HANDLERS(7)
+ARM_DP_HANDLERS(8) ARM_DP_HANDLERS(9) ARM_DP_HANDLERS(10) ARM_DP_HANDLERS(11)
+ARM_DP_HANDLERS(12) ARM_DP_HANDLERS(13) ARM_DP_HANDLERS(14) ARM_DP_HANDLERS(15)
 
-	return so;
-}
+#define ARM_DP_ENTRY(opcode, form) { arm_dp_##opcode##_##form##_0, arm_dp_##opcode##_##form##_1 }
+#define ARM_DP_ENTRIES(opcode) { \
+	ARM_DP_ENTRY(opcode, 0), ARM_DP_ENTRY(opcode, 1), ARM_DP_ENTRY(opcode, 2), \
+	ARM_DP_ENTRY(opcode, 3), ARM_DP_ENTRY(opcode, 4), ARM_DP_ENTRY(opcode, 5), \
+	ARM_DP_ENTRY(opcode, 6), ARM_DP_ENTRY(opcode, 7), ARM_DP_ENTRY(opcode, 8) }
 
-int getShifterOperandImmediate(uint32_t ins, int so, char* operand) {
-	return getShifterOperand(so, get_bits(ins, 11, 7), operand);
-}
+static const arm_instruction_handler arm_dp_handlers[16][ARM_SHIFTER_FORMS][2] = {
+	ARM_DP_ENTRIES(0), ARM_DP_ENTRIES(1), ARM_DP_ENTRIES(2), ARM_DP_ENTRIES(3),
+	ARM_DP_ENTRIES(4), ARM_DP_ENTRIES(5), ARM_DP_ENTRIES(6), ARM_DP_ENTRIES(7),
+	ARM_DP_ENTRIES(8), ARM_DP_ENTRIES(9), ARM_DP_ENTRIES(10), ARM_DP_ENTRIES(11),
+	ARM_DP_ENTRIES(12), ARM_DP_ENTRIES(13), ARM_DP_ENTRIES(14), ARM_DP_ENTRIES(15)
+};
 
-int getShifterOperandRegister(arm_core p, uint32_t ins, int so, char* operand) {
-	return getShifterOperand(so, arm_read_register(p, get_bits(ins, 11, 8)), operand);
+arm_instruction_handler arm_data_processing_handler(arm_decoded_instruction *d) {
+	int form = d->kind == ARM_KIND_DATA_PROCESSING_IMMEDIATE ? ARM_SHIFTER_IMMEDIATE : 1 + d->shift;
+
+	return arm_dp_handlers[d->opcode][form][d->s];
 }
 
-/* Decoding functions for different classes of instructions */
-int arm_data_processing_shift(arm_core p, uint32_t ins) {
-	int opcode = get_bits(ins, 24, 21); // Opération à effectuer
-	int rn = get_bits(ins, 19, 16);
-	int rd = get_bits(ins, 15, 12);
-	int updateCPSR = get_bit(ins, 20); // Doit-on mettre à jour les flags ZNCV ?
-	
-	int rm = get_bits(ins, 3, 0);
-	uint32_t shifter_operand = arm_read_register(p, rm);
-	uint32_t valueRn = arm_read_register(p, rn);
-	
-	if(rm == 15) { // voir doc ARM A5-8
-		shifter_operand += 8;
-	}
-	else if(rn == 15) {
-		shifter_operand = valueRn + 8;
-	}
+/* Multiplications, voir doc ARM A3.5. Les registres y sont placés autrement que dans les
+ * traitements de données : Rd (ou RdHi) occupe les bits 19-16 et Rn (ou RdLo) les bits 15-12.
+ */
+int arm_multiply(arm_core p, arm_decoded_instruction *d) {
+	uint8_t rdHi = d->rn, rdLo = d->rd;
+	uint32_t valueRm = arm_read_register(p, d->rm);
+	uint32_t valueRs = arm_read_register(p, d->rs);
+	uint32_t res;
 
-	for(int i=0; i < 7; i++) { // On effectue l'opération lsl, lsr, asr ou ror sur shifter_operand
-		if(get_bits(ins, 6, 4) == i) {
-			char* op = (i < 2)? "lsl" : (i < 4)? "lsr" : (i < 6)? "asr" : "ror";
-			shifter_operand = (i%2 == 0)?
-				getShifterOperandImmediate(ins, shifter_operand, op) :
-				getShifterOperandRegister(p, ins, shifter_operand, op);
-			break;
-		}
+	if(!get_bit(d->ins, 23)) { // MUL et MLA, voir doc ARM A4-66 et A4-54
+		res = valueRm * valueRs;
+		if(get_bit(d->ins, 21)) // MLA : on ajoute Rn
+			res += arm_read_register(p, rdLo);
+		arm_write_register(p, rdHi, res);
+	} else { // UMULL, UMLAL, SMULL et SMLAL, voir doc ARM A4-116 et suivantes
+		uint64_t product;
+		uint32_t hi, lo;
+
+		if(get_bit(d->ins, 22)) // Signée
+			product = (uint64_t) ((int64_t) (int32_t) valueRm * (int32_t) valueRs);
+		else
+			product = (uint64_t) valueRm * valueRs;
+		if(get_bit(d->ins, 21)) // Accumulation dans RdHi:RdLo
+			product += ((uint64_t) arm_read_register(p, rdHi) << 32) | arm_read_register(p, rdLo);
+		lo = product;
+		hi = product >> 32;
+		arm_write_register(p, rdLo, lo);
+		arm_write_register(p, rdHi, hi);
+		res = hi | (lo != 0); // Mêmes flags N et Z que le résultat sur 64 bits
 	}
-	
-    return executeInst(opcode, p, rd, valueRn, shifter_operand, updateCPSR);
-}
 
-int arm_data_processing_immediate_msr(arm_core p, uint32_t ins) {
-    int opcode = get_bits(ins, 24, 21); // Opération à effectuer
-	int rn = get_bits(ins, 19, 16);
-	int rd = get_bits(ins, 15, 12);
-	int updateCPSR = get_bit(ins, 20); // Doit-on mettre à jour les flags ZNCV ?
-	int rotate_imm = get_bits(ins, 11, 8);
-	uint32_t shifter_operand = get_bits(ins, 7, 0);
-	
-	shifter_operand = ror(shifter_operand, 2*rotate_imm); // voir doc ARM A5-6
-	uint32_t valueRn = arm_read_register(p, rn);
-	
-    return executeInst(opcode, p, rd, valueRn, shifter_operand, updateCPSR);
+	if(d->s) { // N et Z sont mis à jour, C est imprévisible (on le conserve) et V inchangé
+		if(trace_has(REGISTERS))
+			arm_write_cpsr(p, arm_flags_evaluate(ARM_FLAGS_LOGICAL, 0, 0, res, arm_read_cpsr(p)));
+		else
+			arm_set_flags(p, ARM_FLAGS_LOGICAL, 0, 0, res);
+	}
+	return 0;
 }
@@ -24,8 +24,19 @@ Contact: Guillaume.Huard@imag.fr
 #define __ARM_DATA_PROCESSING_H__
 #include <stdint.h>
 #include "arm_core.h"
+#include "arm_decode_cache.h"
 
-int arm_data_processing_shift(arm_core p, uint32_t ins);
-int arm_data_processing_immediate_msr(arm_core p, uint32_t ins);
+/* Returns cpsr with the flags N, Z, C and V set by an operation of the given
+ * kind (see arm_set_flags in arm_core.h)
+ */
+uint32_t arm_flags_evaluate(uint8_t kind, uint32_t a, uint32_t b, uint32_t res,
+                            uint32_t cpsr);
+
+/* Handler specialised for the opcode, the shifter operand form and the S bit
+ * of a data processing instruction, whose kind has been set by arm_decode
+ */
+arm_instruction_handler arm_data_processing_handler(arm_decoded_instruction *d);
+/* MUL, MLA, UMULL, UMLAL, SMULL and SMLAL */
+int arm_multiply(arm_core p, arm_decoded_instruction *d);
 
 #endif
@@ -0,0 +1,85 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <stdlib.h>
+#include "arm_decode_cache.h"
+#include "memory.h"
+
+#define DECODE_CACHE_SHIFT 14
+#define DECODE_CACHE_SIZE (1 << DECODE_CACHE_SHIFT)
+#define DECODE_CACHE_INDEX(address) \
+                (((address) >> 2) & (DECODE_CACHE_SIZE - 1))
+/* Number of instructions in a memory page */
+#define PAGE_INSTRUCTIONS (1 << (MEMORY_PAGE_SHIFT - 2))
+
+struct arm_decode_cache_data {
+    arm_decoded_instruction entries[DECODE_CACHE_SIZE];
+};
+
+arm_decode_cache arm_decode_cache_create() {
+    arm_decode_cache c;
+
+    c = malloc(sizeof(struct arm_decode_cache_data));
+    if (c)
+        arm_decode_cache_flush(c);
+    return c;
+}
+
+void arm_decode_cache_destroy(arm_decode_cache c) {
+    free(c);
+}
+
+arm_decoded_instruction *arm_decode_cache_entry(arm_decode_cache c,
+                                                uint32_t address) {
+    arm_decoded_instruction *d = &c->entries[DECODE_CACHE_INDEX(address)];
+
+    if (d->address != address) {
+        d->address = address;
+        d->handler = NULL;
+    }
+    return d;
+}
+
+/* The instructions of a page are stored in PAGE_INSTRUCTIONS consecutive
+ * entries, among which only those tagged with an address of the page are
+ * dropped.
+ */
+void arm_decode_cache_invalidate_page(arm_decode_cache c, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_SHIFT;
+    uint32_t first = DECODE_CACHE_INDEX(page << MEMORY_PAGE_SHIFT);
+    int i;
+
+    for (i=0; i<PAGE_INSTRUCTIONS && first+i < DECODE_CACHE_SIZE; i++) {
+        arm_decoded_instruction *d = &c->entries[first + i];
+        if ((d->address >> MEMORY_PAGE_SHIFT) == page)
+            d->handler = NULL;
+    }
+}
+
+void arm_decode_cache_flush(arm_decode_cache c) {
+    int i;
+
+    for (i=0; i<DECODE_CACHE_SIZE; i++) {
+        c->entries[i].address = 0;
+        c->entries[i].handler = NULL;
+    }
+}
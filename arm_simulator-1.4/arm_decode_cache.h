@@ -0,0 +1,85 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __ARM_DECODE_CACHE_H__
+#define __ARM_DECODE_CACHE_H__
+#include <stdint.h>
+#include "arm_core.h"
+
+/* Cache of predecoded instructions, indexed by the address of the instruction.
+ * Each entry keeps the opcode, the handler that executes it and the fields
+ * the handler needs, so that an instruction executed many times is decoded
+ * only once. The cache is direct mapped: an entry is valid only if its address
+ * is the one looked up and its handler is not NULL.
+ */
+typedef int (*arm_instruction_handler)(arm_core p, arm_decoded_instruction *d);
+
+/* Kinds of instructions, on which the threaded interpreter dispatches */
+#define ARM_KIND_OTHER                      0
+#define ARM_KIND_DATA_PROCESSING_SHIFT      1
+#define ARM_KIND_DATA_PROCESSING_IMMEDIATE  2
+#define ARM_KIND_LOAD_STORE                 3
+#define ARM_KIND_BRANCH                     4
+/* Always raises an exception, stops a sequence of instructions (breakpoint) */
+#define ARM_KIND_EXCLUDED                   5
+
+/* Pairs of instructions of a block executed as a single operation, the first
+ * instruction of the pair is marked with the kind of fusion
+ */
+#define ARM_FUSION_NONE           0
+#define ARM_FUSION_COMPARE_BRANCH 1 /* CMP or SUBS followed by B or BL */
+#define ARM_FUSION_LOAD_ALU       2 /* LDR followed by data processing on rd */
+#define ARM_FUSION_COUNT          3
+
+struct arm_decoded_instruction {
+    uint32_t address;
+    uint32_t ins;
+    arm_instruction_handler handler;
+    uint8_t kind;
+    uint8_t fusion;
+    uint8_t cond;
+    uint8_t opcode;     /* bits 24-21 for data processing */
+    uint8_t s;          /* bit 20 */
+    uint8_t rn;         /* bits 19-16 */
+    uint8_t rd;         /* bits 15-12 */
+    uint8_t rs;         /* bits 11-8 */
+    uint8_t rm;         /* bits 3-0 */
+    uint8_t shift;      /* bits 6-4, shift kind and register/immediate form */
+    uint8_t shift_imm;  /* bits 11-7 */
+    uint32_t immediate; /* rotated immediate, offset or branch displacement */
+};
+
+typedef struct arm_decode_cache_data *arm_decode_cache;
+
+arm_decode_cache arm_decode_cache_create();
+void arm_decode_cache_destroy(arm_decode_cache c);
+
+/* Returns the entry in which the instruction at address is stored. If this
+ * entry held another instruction, it is reset to address with a NULL handler:
+ * the caller is then in charge of filling ins and decoding it.
+ */
+arm_decoded_instruction *arm_decode_cache_entry(arm_decode_cache c,
+                                                uint32_t address);
+void arm_decode_cache_invalidate_page(arm_decode_cache c, uint32_t address);
+void arm_decode_cache_flush(arm_decode_cache c);
+
+#endif
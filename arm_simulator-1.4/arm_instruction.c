@@ -26,8 +26,16 @@ Contact: Guillaume.Huard@imag.fr
 #include "arm_load_store.h"
 #include "arm_branch_other.h"
 #include "arm_constants.h"
+#include "arm_decode_cache.h"
+#include "arm_block_cache.h"
+#include "arm_jit.h"
+#include "trace.h"
 #include "util.h"
 
+/* Nombre maximal d'instructions exécutées par arm_run entre deux vérifications d'une demande
+ * d'arrêt ou d'un point d'arrêt */
+#define ARM_RUN_CHUNK 4096
+
 uint8_t arm_decode_condition[224]; //La taille est 224 car condCounter < 14 et flagCounter < 16. On accède à un élément de cette façon : 
 								   //"arm_decode_condition[(condCounter<<4)|flagCounter]" Donc l'indice maximum est 223 soit 224 éléments maximum.
 uint8_t arm_decode_condition_init = 0;//Variable permettant de savoir si le tableau ci-dessus a été initialisé
@@ -89,66 +97,676 @@ void init_decode_condition() { //Création d'un tableau permettant de récupére
 	}
 }
 
+/* Adaptateurs pour les classes d'instructions dont les handlers décodent eux-mêmes l'instruction */
+static int arm_undefined(arm_core p, arm_decoded_instruction *d) {
+	return UNDEFINED_INSTRUCTION;
+}
+
+static int arm_breakpoint(arm_core p, arm_decoded_instruction *d) { // BKPT, voir doc ARM A4.1.7
+	return PREFETCH_ABORT;
+}
+
+static int arm_miscellaneous_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_miscellaneous(p, d->ins);
+}
+
+static int arm_branch_exchange_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_branch_exchange(p, d->ins);
+}
+
+static int arm_count_leading_zeros_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_count_leading_zeros(p, d->ins);
+}
+
+static int arm_swap_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_swap(p, d->ins);
+}
+
+static int arm_load_store_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_load_store(p, d->ins);
+}
+
+static int arm_load_store_multiple_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_load_store_multiple(p, d->ins);
+}
+
+static int arm_coprocessor_load_store_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_coprocessor_load_store(p, d->ins);
+}
+
+static int arm_branch_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_branch(p, d->ins);
+}
+
+static int arm_coprocessor_others_swi_decoded(arm_core p, arm_decoded_instruction *d) {
+	return arm_coprocessor_others_swi(p, d->ins); // Fin de programme
+}
+
+/* Classes d'instructions ARMv5T (voir doc ARM A3.1), chacune exécutée par son handler */
+enum {
+	ARM_CLASS_UNDEFINED,
+	ARM_CLASS_DATA_PROCESSING_SHIFT,
+	ARM_CLASS_DATA_PROCESSING_IMMEDIATE,
+	ARM_CLASS_STATUS_REGISTER,       // MRS et MSR
+	ARM_CLASS_BRANCH_EXCHANGE,       // BX et BLX (2)
+	ARM_CLASS_COUNT_LEADING_ZEROS,   // CLZ
+	ARM_CLASS_BREAKPOINT,            // BKPT
+	ARM_CLASS_MULTIPLY,              // MUL, MLA et multiplications longues
+	ARM_CLASS_SWAP,                  // SWP et SWPB
+	ARM_CLASS_EXTRA_LOAD_STORE,      // LDRH, STRH, LDRSB, LDRSH, LDRD et STRD
+	ARM_CLASS_LOAD_STORE,            // LDR, STR, LDRB et STRB
+	ARM_CLASS_LOAD_STORE_MULTIPLE,
+	ARM_CLASS_BRANCH,
+	ARM_CLASS_COPROCESSOR_LOAD_STORE,
+	ARM_CLASS_COPROCESSOR_SWI,
+	ARM_CLASS_COUNT
+};
+
+static const struct {
+	arm_instruction_handler handler;
+	uint8_t kind;
+} arm_classes[ARM_CLASS_COUNT] = {
+	[ARM_CLASS_UNDEFINED] = { arm_undefined, ARM_KIND_EXCLUDED },
+	// Le handler dépend aussi de l'opcode, de la forme du décalage et du bit S, voir arm_decode
+	[ARM_CLASS_DATA_PROCESSING_SHIFT] = { NULL, ARM_KIND_DATA_PROCESSING_SHIFT },
+	[ARM_CLASS_DATA_PROCESSING_IMMEDIATE] = { NULL, ARM_KIND_DATA_PROCESSING_IMMEDIATE },
+	[ARM_CLASS_STATUS_REGISTER] = { arm_miscellaneous_decoded, ARM_KIND_OTHER },
+	[ARM_CLASS_BRANCH_EXCHANGE] = { arm_branch_exchange_decoded, ARM_KIND_OTHER },
+	[ARM_CLASS_COUNT_LEADING_ZEROS] = { arm_count_leading_zeros_decoded, ARM_KIND_OTHER },
+	[ARM_CLASS_BREAKPOINT] = { arm_breakpoint, ARM_KIND_EXCLUDED },
+	[ARM_CLASS_MULTIPLY] = { arm_multiply, ARM_KIND_OTHER },
+	[ARM_CLASS_SWAP] = { arm_swap_decoded, ARM_KIND_OTHER },
+	[ARM_CLASS_EXTRA_LOAD_STORE] = { arm_load_store_decoded, ARM_KIND_LOAD_STORE },
+	[ARM_CLASS_LOAD_STORE] = { arm_load_store_decoded, ARM_KIND_LOAD_STORE },
+	[ARM_CLASS_LOAD_STORE_MULTIPLE] = { arm_load_store_multiple_decoded, ARM_KIND_OTHER },
+	[ARM_CLASS_BRANCH] = { arm_branch_decoded, ARM_KIND_BRANCH },
+	[ARM_CLASS_COPROCESSOR_LOAD_STORE] = { arm_coprocessor_load_store_decoded, ARM_KIND_EXCLUDED },
+	[ARM_CLASS_COPROCESSOR_SWI] = { arm_coprocessor_others_swi_decoded, ARM_KIND_EXCLUDED }
+};
+
+/* Classe d'une instruction dont la condition n'est pas 1111, en fonction de ses bits 27-20 (h)
+ * et 7-4 (l). Ce sont des expressions constantes : la table arm_decode_table ci-dessous est
+ * entièrement calculée à la compilation.
+ */
+// Bits 24-23 à 10 et bit 20 à 0 : TST, TEQ, CMP et CMN sans S, réutilisés par d'autres instructions
+#define ARM_MISCELLANEOUS_SPACE(h) (((h) & 0x19) == 0x10)
+
+#define ARM_CLASS_SHIFT_IMMEDIATE(h, l) /* bit 4 à 0 */ \
+	(!ARM_MISCELLANEOUS_SPACE(h) ? ARM_CLASS_DATA_PROCESSING_SHIFT : \
+	 (l) == 0 ? ARM_CLASS_STATUS_REGISTER : \
+	 ARM_CLASS_UNDEFINED) // Multiplications signées 16 bits (ARMv5TE)
+
+#define ARM_CLASS_SHIFT_REGISTER(h, l) /* bit 4 à 1, bit 7 à 0 */ \
+	(!ARM_MISCELLANEOUS_SPACE(h) ? ARM_CLASS_DATA_PROCESSING_SHIFT : \
+	 (h) == 0x12 && ((l) == 1 || (l) == 3) ? ARM_CLASS_BRANCH_EXCHANGE : \
+	 (h) == 0x12 && (l) == 7 ? ARM_CLASS_BREAKPOINT : \
+	 (h) == 0x16 && (l) == 1 ? ARM_CLASS_COUNT_LEADING_ZEROS : \
+	 ARM_CLASS_UNDEFINED) // Arithmétique saturée (ARMv5TE)
+
+#define ARM_CLASS_MULTIPLY_EXTRA(h, l) /* bits 7 et 4 à 1 */ \
+	((l) != 9 ? ARM_CLASS_EXTRA_LOAD_STORE : /* bits 6-5 non nuls */ \
+	 (h) < 0x04 || ((h) >= 0x08 && (h) < 0x10) ? ARM_CLASS_MULTIPLY : \
+	 (h) == 0x10 || (h) == 0x14 ? ARM_CLASS_SWAP : \
+	 ARM_CLASS_UNDEFINED)
+
+#define ARM_CLASS(h, l) \
+	((h) >> 5 == 0 ? (!((l) & 1) ? ARM_CLASS_SHIFT_IMMEDIATE(h, l) : \
+	                  !((l) & 8) ? ARM_CLASS_SHIFT_REGISTER(h, l) : \
+	                  ARM_CLASS_MULTIPLY_EXTRA(h, l)) : \
+	 (h) >> 5 == 1 ? (!ARM_MISCELLANEOUS_SPACE(h) ? ARM_CLASS_DATA_PROCESSING_IMMEDIATE : \
+	                  (h) & 2 ? ARM_CLASS_STATUS_REGISTER : ARM_CLASS_UNDEFINED) : \
+	 (h) >> 5 == 2 ? ARM_CLASS_LOAD_STORE : \
+	 (h) >> 5 == 3 ? ((l) & 1 ? ARM_CLASS_UNDEFINED : ARM_CLASS_LOAD_STORE) : /* Bit 4 à 1 : points d'arrêt de gdb */ \
+	 (h) >> 5 == 4 ? ARM_CLASS_LOAD_STORE_MULTIPLE : \
+	 (h) >> 5 == 5 ? ARM_CLASS_BRANCH : \
+	 (h) >> 5 == 6 ? ARM_CLASS_COPROCESSOR_LOAD_STORE : \
+	 ARM_CLASS_COPROCESSOR_SWI)
+
+#define ARM_DECODE_ROW(h) \
+	ARM_CLASS(h, 0), ARM_CLASS(h, 1), ARM_CLASS(h, 2), ARM_CLASS(h, 3), \
+	ARM_CLASS(h, 4), ARM_CLASS(h, 5), ARM_CLASS(h, 6), ARM_CLASS(h, 7), \
+	ARM_CLASS(h, 8), ARM_CLASS(h, 9), ARM_CLASS(h, 10), ARM_CLASS(h, 11), \
+	ARM_CLASS(h, 12), ARM_CLASS(h, 13), ARM_CLASS(h, 14), ARM_CLASS(h, 15)
+#define ARM_DECODE_ROWS(h) \
+	ARM_DECODE_ROW((h) + 0), ARM_DECODE_ROW((h) + 1), ARM_DECODE_ROW((h) + 2), ARM_DECODE_ROW((h) + 3), \
+	ARM_DECODE_ROW((h) + 4), ARM_DECODE_ROW((h) + 5), ARM_DECODE_ROW((h) + 6), ARM_DECODE_ROW((h) + 7), \
+	ARM_DECODE_ROW((h) + 8), ARM_DECODE_ROW((h) + 9), ARM_DECODE_ROW((h) + 10), ARM_DECODE_ROW((h) + 11), \
+	ARM_DECODE_ROW((h) + 12), ARM_DECODE_ROW((h) + 13), ARM_DECODE_ROW((h) + 14), ARM_DECODE_ROW((h) + 15)
+
+/* Classe de chaque instruction, indexée par ses bits 27-20 et 7-4. Une classe tient sur un
+ * octet : la table (4 Ko) reste dans le cache du processeur hôte.
+ */
+static const uint8_t arm_decode_table[4096] = {
+	ARM_DECODE_ROWS(0x00), ARM_DECODE_ROWS(0x10), ARM_DECODE_ROWS(0x20), ARM_DECODE_ROWS(0x30),
+	ARM_DECODE_ROWS(0x40), ARM_DECODE_ROWS(0x50), ARM_DECODE_ROWS(0x60), ARM_DECODE_ROWS(0x70),
+	ARM_DECODE_ROWS(0x80), ARM_DECODE_ROWS(0x90), ARM_DECODE_ROWS(0xA0), ARM_DECODE_ROWS(0xB0),
+	ARM_DECODE_ROWS(0xC0), ARM_DECODE_ROWS(0xD0), ARM_DECODE_ROWS(0xE0), ARM_DECODE_ROWS(0xF0)
+};
+
+/* Décodage d'une instruction : on choisit son handler et on extrait une fois pour toutes
+ * les champs dont il a besoin. Le résultat est conservé dans le cache d'instructions décodées.
+ */
+static void arm_decode(arm_decoded_instruction *d) {
+	uint32_t inst = d->ins;
+	int class;
+
+	d->cond = get_bits(inst, 31, 28);
+	d->opcode = get_bits(inst, 24, 21);
+	d->s = get_bit(inst, 20);
+	d->rn = get_bits(inst, 19, 16);
+	d->rd = get_bits(inst, 15, 12);
+	d->rs = get_bits(inst, 11, 8);
+	d->rm = get_bits(inst, 3, 0);
+	d->shift = get_bits(inst, 6, 4);
+	d->shift_imm = get_bits(inst, 11, 7);
+	d->immediate = 0;
+	d->fusion = ARM_FUSION_NONE;
+
+	if (d->cond == 0b1111) // Espace inconditionnel : BLX (1) et coprocesseur, sans Thumb ni coprocesseur
+		class = ARM_CLASS_UNDEFINED;
+	else
+		class = arm_decode_table[(get_bits(inst, 27, 20) << 4) | get_bits(inst, 7, 4)];
+	d->handler = arm_classes[class].handler;
+	d->kind = arm_classes[class].kind;
+
+	switch(class) {
+		case ARM_CLASS_DATA_PROCESSING_SHIFT:
+			d->handler = arm_data_processing_handler(d);
+			break;
+		case ARM_CLASS_DATA_PROCESSING_IMMEDIATE:
+			d->immediate = ror(get_bits(inst, 7, 0), 2*get_bits(inst, 11, 8)); // voir doc ARM A5-6
+			d->handler = arm_data_processing_handler(d);
+			break;
+		case ARM_CLASS_LOAD_STORE:
+			d->immediate = get_bits(inst, 11, 0);
+			break;
+		case ARM_CLASS_BRANCH:
+			d->immediate = get_bits(inst, 23, 0) << 2; // Déplacement signé sur 26 bits
+			if(get_bit(inst, 23))
+				d->immediate |= 0xFC000000;
+			break;
+	}
+}
+
+/* Vérifie la condition de l'instruction à partir des flags ZNCV */
+/* Conditions qui ne dépendent que de N et Z (EQ, NE, MI, PL) : les flags C et V, évalués à la demande
+ * (voir arm_set_flags), ne sont alors pas calculés */
+#define arm_condition_needs_cv(cond) (!((0x33 >> (cond)) & 1))
+
+static int arm_check_condition(arm_core p, arm_decoded_instruction *d) {
+	uint8_t flags;
+
+	if(d->cond < 0b1110) { // NOT ALWAYS
+		if(trace_has(REGISTERS)) // La lecture du CPSR fait partie de la trace
+			flags = get_bits(arm_read_cpsr(p), 31, 28); // flags ZNCV
+		else
+			flags = arm_get_flags(p, arm_condition_needs_cv(d->cond));
+		init_decode_condition();
+		
+		return arm_decode_condition[(d->cond<<4)|flags]; // Si on ne passe pas la condition, l'instruction n'est pas exécutée
+	}
+	return 1;
+}
+
 static int arm_execute_instruction(arm_core p) {
-	uint32_t inst;
-	uint8_t instType, cond, flags;
-	int res = arm_fetch(p, &inst); // On récupère l'instruction à éxécuter (PC est incrémenté dans cette fonction)
+	arm_decoded_instruction *d;
+	int res = arm_fetch_decoded(p, &d); // On récupère l'instruction à éxécuter (PC est incrémenté dans cette fonction)
 	
 	if(res != 0)
 		return PREFETCH_ABORT;
 	
-	cond =  get_bits(inst, 31, 28);
+	if(!d->handler) // L'instruction n'est pas encore dans le cache
+		arm_decode(d);
 	
-	if (cond == 0b1111) // Instruction inconnue
-		return UNDEFINED_INSTRUCTION;
+	if(!arm_check_condition(p, d))
+		return 0;
 	
-	if(cond != 0b1110) { // NOT ALWAYS
-		flags = get_bits(arm_read_cpsr(p), 31, 28); // flags ZNCV
-		init_decode_condition();
-		
-		if(!arm_decode_condition[(cond<<4)|flags]) { // Si on ne passe pas la condition, l'instruction n'est pas exécutée
+	return d->handler(p, d);
+}
+
+
+int arm_step(arm_core p) {
+    int result = arm_execute_instruction(p);
+    if (result)
+        arm_exception(p, result);
+    return result;
+}
+
+/* Une instruction qui lève toujours une exception (instruction non définie, swi, coprocesseur)
+ * ne fait pas partie d'un bloc : elle est exécutée par arm_step. C'est en particulier le cas
+ * des points d'arrêt placés par gdb.
+ */
+static int arm_block_excluded(arm_decoded_instruction *d) {
+	return d->kind == ARM_KIND_EXCLUDED;
+}
+
+/* Une instruction qui peut modifier PC termine le bloc */
+static int arm_block_ends_with(arm_decoded_instruction *d) {
+	return d->handler == arm_branch_decoded || d->handler == arm_branch_exchange_decoded ||
+	       d->rd == 15 || // écriture dans PC (traitement de données, LDR, MRS)
+	       (d->handler == arm_load_store_multiple_decoded && get_bit(d->ins, 15)); // LDM avec PC
+}
+
+/* Nombre d'exécutions de chaque type de fusion */
+static uint32_t arm_fusion_stats[ARM_FUSION_COUNT];
+
+static int arm_is_data_processing(arm_decoded_instruction *d) {
+	return d->kind == ARM_KIND_DATA_PROCESSING_SHIFT || d->kind == ARM_KIND_DATA_PROCESSING_IMMEDIATE;
+}
+
+/* Type de fusion de la paire d'instructions (d, next), toutes deux dans un bloc */
+static int arm_fusion(arm_decoded_instruction *d, arm_decoded_instruction *next) {
+	if(d->cond != 0b1110) // La première instruction est toujours exécutée
+		return ARM_FUSION_NONE;
+	if(arm_is_data_processing(d) && d->rd != 15 &&
+	   (d->opcode == 0b1010 || (d->opcode == 0b0010 && d->s)) && // CMP ou SUBS
+	   next->kind == ARM_KIND_BRANCH)
+		return ARM_FUSION_COMPARE_BRANCH;
+	if(get_bits(d->ins, 27, 25) == 2 && get_bit(d->ins, 20) && !get_bit(d->ins, 22) && d->rd != 15 && // LDR
+	   arm_is_data_processing(next) &&
+	   (next->rn == d->rd || (next->kind == ARM_KIND_DATA_PROCESSING_SHIFT &&
+	                          (next->rm == d->rd || (get_bit(next->shift, 0) && next->rs == d->rd)))))
+		return ARM_FUSION_LOAD_ALU;
+	return ARM_FUSION_NONE;
+}
+
+/* Exécute la paire d'instructions fusionnées commençant par d, sans trace : le pc n'est écrit
+ * que pour les handlers qui le lisent et le branchement est fait directement. Retourne le nombre
+ * d'instructions exécutées, 1 si la première lève une exception.
+ */
+static int arm_execute_fused(arm_core p, arm_decoded_instruction *d, int *result) {
+	arm_decoded_instruction *next = d + 1;
+
+	arm_add_cycles(p, 1);
+	arm_set_pc(p, d->address + 4);
+	*result = d->handler(p, d);
+	if(*result)
+		return 1;
+	arm_add_cycles(p, 1);
+	arm_fusion_stats[d->fusion]++;
+	switch(d->fusion) {
+		case ARM_FUSION_COMPARE_BRANCH: // Même calcul que arm_branch
+			if(arm_check_condition(p, next)) {
+				if(get_bit(next->ins, 24))
+					arm_write_register(p, 14, next->address + 4);
+				arm_set_pc(p, next->address + 8 + next->immediate);
+			} else {
+				arm_set_pc(p, next->address + 4);
+			}
+			break;
+		case ARM_FUSION_LOAD_ALU:
+			arm_set_pc(p, next->address + 4);
+			if(arm_check_condition(p, next))
+				*result = next->handler(p, next);
+			break;
+	}
+	return 2;
+}
+
+void arm_print_fusion_stats(FILE *out) {
+	fprintf(out, "Fused pairs of instructions executed:\n"
+	             "  CMP/SUBS + B/BL        : %u\n"
+	             "  LDR + data processing  : %u\n",
+	        arm_fusion_stats[ARM_FUSION_COMPARE_BRANCH], arm_fusion_stats[ARM_FUSION_LOAD_ALU]);
+}
+
+/* Registres lus et écrits par une instruction, sous forme d'ensembles de bits (le bit 16 représente
+ * les flags ZNCV). Le pc n'en fait pas partie, sa valeur ne dépend que de l'adresse de l'instruction.
+ * Retourne 0 si l'instruction peut avoir un effet de bord (écriture en mémoire, changement de mode...) :
+ * seuls les traitements de données, les chargements sans réécriture de la base et les branchements sont
+ * acceptés.
+ */
+#define ARM_FLAGS_BIT (1 << 16)
+
+static int arm_registers_used(arm_decoded_instruction *d, uint32_t *read, uint32_t *written) {
+	*read = (d->cond < 0b1110)? ARM_FLAGS_BIT : 0;
+	*written = 0;
+	if(arm_is_data_processing(d)) {
+		if(d->rd == 15)
 			return 0;
+		if(d->opcode != 0b1101 && d->opcode != 0b1111) // MOV et MVN ne lisent pas Rn
+			*read |= 1 << d->rn;
+		if(d->kind == ARM_KIND_DATA_PROCESSING_SHIFT) {
+			*read |= 1 << d->rm;
+			if(get_bit(d->shift, 0))
+				*read |= 1 << d->rs;
 		}
+		if(d->opcode >= 0b0101 && d->opcode <= 0b0111) // ADC, SBC, RSC
+			*read |= ARM_FLAGS_BIT;
+		if(d->opcode < 0b1000 || d->opcode > 0b1011) // Sauf TST, TEQ, CMP, CMN
+			*written |= 1 << d->rd;
+		if(d->s || (d->opcode >= 0b1000 && d->opcode <= 0b1011))
+			*written |= ARM_FLAGS_BIT;
+	} else if(d->kind == ARM_KIND_LOAD_STORE && get_bits(d->ins, 27, 26) == 1) { // LDR et LDRB
+		if(!get_bit(d->ins, 20) || !p(d->ins) || w(d->ins) || d->rd == 15)
+			return 0;
+		*read |= 1 << d->rn;
+		if(get_bit(d->ins, 25))
+			*read |= 1 << d->rm;
+		*written |= 1 << d->rd;
+	} else if(d->kind == ARM_KIND_BRANCH) {
+		if(get_bit(d->ins, 24)) // BL
+			*written |= 1 << 14;
+	} else {
+		return 0;
+	}
+	*read &= ~(1 << 15);
+	return 1;
+}
+
+/* Un bloc est une boucle inactive s'il se termine par un branchement sur lui même, n'a pas d'effet
+ * de bord et qu'aucune valeur calculée lors d'une itération n'est lue par l'itération suivante :
+ * toutes les itérations laissent alors le processeur dans le même état, jusqu'à une interruption.
+ * Une écriture conditionnelle peut ne pas avoir lieu, elle ne masque donc pas la valeur précédente.
+ */
+static int arm_block_idle(arm_block *b) {
+	arm_decoded_instruction *last = &b->ops[b->length - 1];
+	uint32_t read, written, defined = 0, live = 0, modified = 0;
+
+	if(last->kind != ARM_KIND_BRANCH || last->address + 8 + last->immediate != b->address)
+		return 0;
+	for(int i = 0; i < b->length; i++) {
+		if(!arm_registers_used(&b->ops[i], &read, &written))
+			return 0;
+		live |= read & ~defined; // Valeurs lues qui viennent de l'itération précédente
+		modified |= written;
+		if(b->ops[i].cond >= 0b1110)
+			defined |= written;
+	}
+	return !(live & modified);
+}
+
+/* Construit le bloc qui commence à l'adresse du bloc b */
+static void arm_build_block(arm_core p, arm_block *b) {
+	uint32_t address = b->address;
+
+	b->length = 0;
+	while(b->length < ARM_BLOCK_MAX_LENGTH) {
+		arm_decoded_instruction *d = &b->ops[b->length];
+
+		if(arm_read_code(p, address, &d->ins))
+			break;
+		d->address = address;
+		arm_decode(d);
+		if(arm_block_excluded(d))
+			break;
+		b->length++;
+		address += 4;
+		if(arm_block_ends_with(d))
+			break;
+	}
+	b->end = address;
+	b->valid = b->length > 0;
+	for(int i = 0; i + 1 < b->length; i++) {
+		b->ops[i].fusion = arm_fusion(&b->ops[i], &b->ops[i+1]);
+		if(b->ops[i].fusion) // Une instruction ne fait partie que d'une paire
+			i++;
+	}
+	b->idle = b->valid && arm_block_idle(b);
+}
+
+static arm_block *arm_find_block(arm_core p, uint32_t address) {
+	arm_block *b = arm_get_block(p, address);
+
+	if(!b->valid)
+		arm_build_block(p, b);
+	return b;
+}
+
+int arm_step_block(arm_core p, uint32_t max, uint32_t *executed) {
+	arm_block *b, *next;
+	uint32_t pc, count = 0, device_accesses = 0;
+	int i, n, result = 0;
+	// Les paires fusionnées ne produisent pas de trace
+	int fuse = !trace_has(MEMORY | REGISTERS | STATE | POSITION);
+
+	b = arm_find_block(p, arm_get_pc(p));
+	if(!b->valid) {
+		*executed = 1;
+		return arm_step(p);
 	}
 	
-	instType = get_bits(inst, 27, 25);
-	switch(instType) {
-		case 0:
-			if(get_bits(inst, 24, 23) == 0b10 && (get_bits(inst, 21, 20) == 0b00 || get_bits(inst, 21, 20) == 0b10)) { // MRS et MSR
-				return arm_miscellaneous(p, inst);
-			}
-			else if(get_bit(inst, 4) == 1 && get_bit(inst, 7) == 1) { // Extra load/stores (load and store halfword, doubleword, load signed byte)
-				return arm_load_store(p, inst);
-			}
-			else {
-				return arm_data_processing_shift(p, inst);
+	while(b) {
+		if(b->idle) // Une itération qui accède à un périphérique n'est pas inactive
+			device_accesses = arm_get_device_accesses(p);
+		// Les premières instructions du bloc peuvent avoir été traduites (voir arm_jit.c)
+		i = arm_jit_execute(p, b, &result);
+		count += i;
+		if(result) {
+			arm_exception(p, result);
+			*executed = count;
+			return result;
+		}
+		for(; i < b->length && b->valid; i++) {
+			arm_decoded_instruction *d = &b->ops[i];
+
+			if(d->fusion && fuse) {
+				n = arm_execute_fused(p, d, &result);
+				count += n;
+				i += n - 1;
+				if(result) {
+					arm_exception(p, result);
+					*executed = count;
+					return result;
+				}
+				continue;
 			}
-		case 1:
-			if(get_bits(inst, 24, 23) == 0b10 && get_bits(inst, 21, 20) == 0b10) { // MSR
-				return arm_miscellaneous(p, inst);
-            } else {
-				return arm_data_processing_immediate_msr(p, inst);
+			arm_fetch_predecoded(p, d);
+			count++;
+			if(arm_check_condition(p, d) && (result = d->handler(p, d))) {
+				arm_exception(p, result);
+				*executed = count;
+				return result;
 			}
-		case 2:
-			return arm_load_store(p, inst);
-		case 3:
-			return arm_load_store(p, inst);
-		case 4:
-			return arm_load_store_multiple(p, inst);
-		case 6:
-			return arm_coprocessor_load_store(p, inst);
-		case 5:
-			return arm_branch(p, inst);
-		case 7:
-			return arm_coprocessor_others_swi(p, inst); // Fin de programme
+		}
+		if(!b->valid || count >= max) // Bloc modifié par l'instruction exécutée ou budget épuisé
+			break;
+		
+		// Chaînage : on suit le lien vers le bloc suivant s'il est toujours valide
+		pc = arm_get_pc(p);
+		if(fuse && b->idle && pc == b->address && arm_get_device_accesses(p) == device_accesses) { // Les itérations suivantes ne changeront rien (voir arm_run)
+			arm_set_idle(p, 1);
+			break;
+		}
+		next = (pc == b->end) ? b->fall_through : b->taken;
+		if(!next || !next->valid || next->address != pc) {
+			next = arm_find_block(p, pc);
+			if(!next->valid) // Instruction exclue des blocs : on rend la main
+				break;
+			if(pc == b->end)
+				b->fall_through = next;
+			else
+				b->taken = next;
+		}
+		b = next;
 	}
+	*executed = count;
 	return 0;
 }
 
+/* Interpréteur à threading direct : chaque type d'instruction a son étiquette, atteinte par
+ * un unique saut indirect (goto calculé, extension de gcc) à la fin du traitement de
+ * l'instruction précédente. Le pc et le nombre d'instructions exécutées restent dans des
+ * variables locales, le pc n'est écrit dans le processeur que lorsqu'un handler peut le lire.
+ * Les accès n'étant pas tracés, on utilise le mode bloc lorsqu'une trace est demandée.
+ */
+int arm_run_threaded(arm_core p, uint32_t max, uint32_t *executed) {
+#if defined(__GNUC__)
+	static void *dispatch[] = {
+		[ARM_KIND_OTHER] = &&other,
+		[ARM_KIND_DATA_PROCESSING_SHIFT] = &&data_processing_shift,
+		[ARM_KIND_DATA_PROCESSING_IMMEDIATE] = &&data_processing_immediate,
+		[ARM_KIND_LOAD_STORE] = &&load_store,
+		[ARM_KIND_BRANCH] = &&branch,
+		[ARM_KIND_EXCLUDED] = &&excluded
+	};
+	arm_decoded_instruction *d;
+	uint32_t pc, count = 0, counted = 0;
+	int result = 0;
 
-int arm_step(arm_core p) {
-    int result = arm_execute_instruction(p);
-    if (result)
-        arm_exception(p, result);
-    return result;
-}
\ No newline at end of file
+	if(trace_has(MEMORY | REGISTERS | STATE | POSITION))
+		return arm_step_block(p, max, executed);
+	init_decode_condition();
+	pc = arm_get_pc(p) & 0xFFFFFFFD; // Adresse lue par arm_fetch
+
+#define ARM_THREADED_NEXT() \
+	do { \
+		if(count >= max) \
+			goto done; \
+		d = arm_get_decoded(p, pc); \
+		if(!d->handler) { \
+			if(arm_read_code(p, pc, &d->ins)) \
+				goto prefetch_abort; \
+			arm_decode(d); \
+		} \
+		if(d->kind == ARM_KIND_EXCLUDED && count > 0) \
+			goto done; \
+		count++; \
+		if(d->cond < 0b1110 && \
+		   !arm_decode_condition[(d->cond<<4) | arm_get_flags(p, arm_condition_needs_cv(d->cond))]) { \
+			pc += 4; \
+			goto skip; \
+		} \
+		goto *dispatch[d->kind]; \
+	} while(0)
+
+/* Le compteur de cycles du processeur est mis à jour avant les handlers qui peuvent accéder
+ * à un périphérique ou terminer la simulation : ils le voient comme avec arm_fetch
+ */
+#define ARM_THREADED_SYNC_CYCLES() \
+	do { \
+		arm_add_cycles(p, count - counted); \
+		counted = count; \
+	} while(0)
+
+skip:
+	ARM_THREADED_NEXT();
+
+data_processing_shift: // Handler spécialisé, voir arm_data_processing_handler
+data_processing_immediate:
+	arm_set_pc(p, pc + 4);
+	result = d->handler(p, d);
+	goto handled;
+
+load_store:
+	arm_set_pc(p, pc + 4);
+	ARM_THREADED_SYNC_CYCLES();
+	result = arm_load_store(p, d->ins);
+	goto handled;
+
+branch: // Même calcul que arm_branch, sans passer par les registres pour le pc
+	if(get_bit(d->ins, 24))
+		arm_write_register(p, 14, pc + 4);
+	if(d->immediate == (uint32_t) -8) { // Branchement sur lui même : boucle inactive (voir arm_run)
+		arm_set_idle(p, 1);
+		goto done;
+	}
+	pc += 8 + d->immediate;
+	ARM_THREADED_NEXT();
+
+excluded: // Première instruction de la séquence, elle lève son exception
+other:
+	arm_set_pc(p, pc + 4);
+	ARM_THREADED_SYNC_CYCLES();
+	result = d->handler(p, d);
+handled:
+	if(result) {
+		arm_exception(p, result);
+		goto end;
+	}
+	pc = arm_get_pc(p) & 0xFFFFFFFD;
+	ARM_THREADED_NEXT();
+
+prefetch_abort:
+	count++;
+	arm_set_pc(p, pc + 4);
+	result = PREFETCH_ABORT;
+	arm_exception(p, result);
+	goto end;
+
+done:
+	arm_set_pc(p, pc);
+end:
+	ARM_THREADED_SYNC_CYCLES();
+	*executed = count;
+	return result;
+#undef ARM_THREADED_SYNC_CYCLES
+#undef ARM_THREADED_NEXT
+#else
+	return arm_step_block(p, max, executed);
+#endif
+}
+
+static int arm_threaded_interpreter = 0;
+
+void arm_use_threaded_interpreter(int enabled) {
+	arm_threaded_interpreter = enabled;
+}
+
+int arm_step_many(arm_core p, uint32_t max, uint32_t *executed) {
+	if(arm_threaded_interpreter)
+		return arm_run_threaded(p, max, executed);
+	return arm_step_block(p, max, executed);
+}
+
+/* Une instruction de point d'arrêt de gdb est-elle à l'adresse de la prochaine instruction ?
+ * On passe par le cache d'instructions décodées, sans tracer l'accès. */
+static int arm_at_breakpoint(arm_core p) {
+	uint32_t address = arm_get_pc(p) & 0xFFFFFFFD;
+	arm_decoded_instruction *d = arm_get_decoded(p, address);
+
+	if(!d->handler) {
+		if(arm_read_code(p, address, &d->ins))
+			return 0;
+		arm_decode(d);
+	}
+	return (d->ins & 0xFFF000F0) == 0xE7F000F0;
+}
+
+int arm_run(arm_core p, uint32_t max_instructions, int stop_conditions) {
+	uint32_t count = 0, executed, chunk;
+	int result;
+
+	arm_set_last_exception(p, 0);
+	while(count < max_instructions) {
+		if((stop_conditions & ARM_STOP_ON_BREAKPOINT) && arm_at_breakpoint(p))
+			return ARM_RUN_BREAKPOINT;
+		arm_set_idle(p, 0);
+		chunk = max_instructions - count;
+		if(trace_has(STATE) || chunk < ARM_BLOCK_MAX_LENGTH) { // Instruction par instruction
+			result = arm_step(p);
+			executed = 1;
+			if(trace_has(STATE))
+				trace_arm_state(p);
+		} else {
+			// Un bloc en cours se termine au plus ARM_BLOCK_MAX_LENGTH-1 instructions après le budget
+			chunk -= ARM_BLOCK_MAX_LENGTH - 1;
+			if(chunk > ARM_RUN_CHUNK)
+				chunk = ARM_RUN_CHUNK;
+			result = arm_step_many(p, chunk, &executed);
+		}
+		count += executed;
+		arm_set_last_exception(p, result);
+		if(result && (stop_conditions & ARM_STOP_ON_EXCEPTION))
+			return ARM_RUN_EXCEPTION;
+		if(arm_stop_requested(p))
+			return ARM_RUN_STOP_REQUESTED;
+		if(arm_is_idle(p)) {
+			if(stop_conditions & ARM_STOP_ON_IDLE)
+				return ARM_RUN_IDLE;
+			count += arm_skip_idle(p, max_instructions - count);
+		}
+	}
+	return ARM_RUN_BUDGET;
+}
+
+uint32_t arm_skip_idle(arm_core p, uint32_t max_instructions) {
+	arm_block *b = arm_find_block(p, arm_get_pc(p));
+	uint32_t skipped;
+
+	if(!b->valid || !b->idle)
+		return 0;
+	skipped = max_instructions - max_instructions % b->length;
+	arm_add_cycles(p, skipped);
+	return skipped;
+}
@@ -24,6 +24,71 @@ Contact: Guillaume.Huard@imag.fr
 #define __ARM_INSTRUCTION_H__
 #include "arm_core.h"
 
+/* Table telling whether a condition is passed, indexed by (cond << 4) | NZCV,
+ * it must be initialized by init_decode_condition before use.
+ */
+extern uint8_t arm_decode_condition[224];
+void init_decode_condition();
+
 int arm_step(arm_core p);
+/* Block level execution mode: runs basic blocks from the pc, following the
+ * links between them, until an exception is raised, at least max instructions
+ * have been executed or the next instruction cannot be part of a block (such
+ * an instruction, like a gdb breakpoint, is left unexecuted, unless it is the
+ * first one, which is then executed by arm_step). The number of executed
+ * instructions is stored in *executed and the result is the one of arm_step.
+ */
+int arm_step_block(arm_core p, uint32_t max, uint32_t *executed);
+/* Within blocks, when nothing is traced, some pairs of instructions (compare
+ * and branch, load and use of the loaded value) are executed as a single
+ * operation. Prints how many times each kind of pair has been executed.
+ */
+void arm_print_fusion_stats(FILE *out);
+/* Direct threaded interpreter, with the same interface and stop conditions as
+ * arm_step_block. It does not use blocks, but dispatches each instruction with
+ * a computed goto on its kind, keeping the pc and the instruction count in
+ * local variables. When a trace is enabled or the compiler does not support
+ * computed gotos, it is the same as arm_step_block.
+ */
+int arm_run_threaded(arm_core p, uint32_t max, uint32_t *executed);
+/* Runs many instructions with the interpreter selected by
+ * arm_use_threaded_interpreter (arm_step_block by default)
+ */
+void arm_use_threaded_interpreter(int enabled);
+int arm_step_many(arm_core p, uint32_t max, uint32_t *executed);
+
+/* Stop conditions of arm_run, to be ored */
+#define ARM_STOP_ON_BREAKPOINT 1    /* before a gdb breakpoint, see below */
+#define ARM_STOP_ON_EXCEPTION  2    /* after an instruction raising one */
+#define ARM_STOP_ON_IDLE       4    /* at the start of an idle loop */
+
+/* Reasons for which arm_run returns */
+#define ARM_RUN_BUDGET         0    /* max_instructions have been executed */
+#define ARM_RUN_BREAKPOINT     1
+#define ARM_RUN_EXCEPTION      2
+#define ARM_RUN_STOP_REQUESTED 3    /* see arm_request_stop */
+#define ARM_RUN_IDLE           4
+
+/* Batch execution: runs at most max_instructions instructions with the
+ * interpreter selected for arm_step_many, until one of the stop_conditions is
+ * met or a stop is requested, and returns the reason for which it stopped.
+ * A gdb breakpoint is the undefined instruction 0xE7F000F0 (whatever its
+ * condition and bits 19-8), it is never executed when ARM_STOP_ON_BREAKPOINT
+ * is given. When the state is traced, instructions are run one by one and the
+ * state is traced after each of them. The exception raised by the last
+ * instruction executed (0 if none) is then given by arm_get_last_exception.
+ * An idle loop is a block that branches to itself, has no side effect and
+ * computes the same values at each iteration (for instance "b ." or a loop
+ * polling RAM), so that only an interrupt can make the core leave it. A loop
+ * polling a memory mapped device is never idle, as the device may change. Once
+ * an iteration has been run, arm_run either returns ARM_RUN_IDLE, if
+ * ARM_STOP_ON_IDLE is given, or skips the iterations that fit in the budget.
+ */
+int arm_run(arm_core p, uint32_t max_instructions, int stop_conditions);
+/* Accounts for as many whole iterations of the idle loop at the pc as fit in
+ * max_instructions (none if the core is not in an idle loop) and returns the
+ * number of instructions skipped this way
+ */
+uint32_t arm_skip_idle(arm_core p, uint32_t max_instructions);
 
 #endif
@@ -0,0 +1,603 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <stdlib.h>
+#include "arm_jit.h"
+#include "arm_instruction.h"
+#include "arm_data_processing.h"
+#include "arm_alu.h"
+#include "arm_load_store.h"
+#include "arm_constants.h"
+#include "trace.h"
+#include "util.h"
+#include "debug.h"
+
+static int jit_enabled = 0;
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+#define JIT_THRESHOLD 16
+#define JIT_ARENA_SIZE (4 << 20)
+/* Upper bound of the size of the translation of a block */
+#define JIT_MAX_BLOCK_SIZE (ARM_BLOCK_MAX_LENGTH * 192 + 64)
+
+/* x86-64 registers */
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define ESI 6
+#define EDI 7
+
+/* Condition codes of jcc */
+#define CC_E  0x4
+#define CC_NE 0x5
+
+/* Opcodes of two operands instructions (r/m32, r32) and their extension for
+ * the immediate form
+ */
+#define X86_ADD 0x01
+#define X86_OR  0x09
+#define X86_AND 0x21
+#define X86_SUB 0x29
+#define X86_SBB 0x19
+#define X86_CMP 0x39
+#define X86_XOR 0x31
+#define X86_MOV 0x89
+#define X86_TEST 0x85
+#define EXT_ADD 0
+#define EXT_AND 4
+#define EXT_SUB 5
+#define EXT_ROR 1
+#define EXT_SHL 4
+#define EXT_SHR 5
+#define EXT_SAR 7
+
+/* Native code of a block is called with the register file of the core, the
+ * core itself and a pointer to store the exception raised. It returns the
+ * number of instructions executed. While it runs, rbx holds the register file,
+ * r12 the core and r13 the pointer to the exception.
+ */
+typedef uint32_t (*arm_native_block)(uint32_t *storage, arm_core p,
+                                     int *result);
+
+/* The arena is never writable and executable at once: it is writable while
+ * blocks are translated into it and executable while they run
+ */
+static uint8_t *arena = NULL;
+static size_t arena_used = 0;
+static int arena_writable = 1;
+/* Incremented each time the arena is reclaimed, which drops all translations
+ */
+static uint32_t generation = 1;
+
+typedef struct {
+    uint8_t *pos;
+    arm_core p;
+    uint8_t *epilogue;
+} jit_emitter;
+
+static void emit8(jit_emitter *e, uint8_t value) {
+    *e->pos++ = value;
+}
+
+static void emit32(jit_emitter *e, uint32_t value) {
+    int i;
+
+    for (i=0; i<4; i++)
+        emit8(e, value >> (8*i));
+}
+
+static void emit64(jit_emitter *e, uint64_t value) {
+    emit32(e, value);
+    emit32(e, value >> 32);
+}
+
+static void emit_modrm(jit_emitter *e, int mod, int reg, int rm) {
+    emit8(e, (mod << 6) | (reg << 3) | rm);
+}
+
+/* Displacement from rbx of a register of the simulated core */
+static int32_t reg_disp(jit_emitter *e, uint8_t reg) {
+    return 4 * arm_get_register_index(e->p, reg);
+}
+
+/* x86 register <- simulated register */
+static void emit_load(jit_emitter *e, int x86, uint8_t reg) {
+    emit8(e, 0x8B);
+    emit_modrm(e, 2, x86, EBX);
+    emit32(e, reg_disp(e, reg));
+}
+
+/* simulated register <- x86 register */
+static void emit_store(jit_emitter *e, int x86, uint8_t reg) {
+    emit8(e, 0x89);
+    emit_modrm(e, 2, x86, EBX);
+    emit32(e, reg_disp(e, reg));
+}
+
+/* simulated register <- constant */
+static void emit_store_imm(jit_emitter *e, uint8_t reg, uint32_t value) {
+    emit8(e, 0xC7);
+    emit_modrm(e, 2, 0, EBX);
+    emit32(e, reg_disp(e, reg));
+    emit32(e, value);
+}
+
+static void emit_mov_imm(jit_emitter *e, int x86, uint32_t value) {
+    emit8(e, 0xB8 + x86);
+    emit32(e, value);
+}
+
+/* dst <- dst op src */
+static void emit_alu(jit_emitter *e, uint8_t op, int dst, int src) {
+    emit8(e, op);
+    emit_modrm(e, 3, src, dst);
+}
+
+static void emit_alu_imm(jit_emitter *e, int ext, int x86, uint32_t value) {
+    emit8(e, 0x81);
+    emit_modrm(e, 3, ext, x86);
+    emit32(e, value);
+}
+
+static void emit_shift(jit_emitter *e, int ext, int x86, uint8_t count) {
+    emit8(e, 0xC1);
+    emit_modrm(e, 3, ext, x86);
+    emit8(e, count);
+}
+
+static void emit_not(jit_emitter *e, int x86) {
+    emit8(e, 0xF7);
+    emit_modrm(e, 3, 2, x86);
+}
+
+/* movabs rax, value */
+static void emit_mov_rax_imm64(jit_emitter *e, uint64_t value) {
+    emit8(e, 0x48);
+    emit8(e, 0xB8);
+    emit64(e, value);
+}
+
+static void emit_call(jit_emitter *e, void *function) {
+    emit_mov_rax_imm64(e, (uint64_t) function);
+    emit8(e, 0xFF);   /* call rax */
+    emit8(e, 0xD0);
+}
+
+/* Conditional jump whose target is set later by patch */
+static uint8_t *emit_jcc(jit_emitter *e, int cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 + cc);
+    emit32(e, 0);
+    return e->pos - 4;
+}
+
+static void patch(jit_emitter *e, uint8_t *jump) {
+    int32_t offset = e->pos - (jump + 4);
+    int i;
+
+    for (i=0; i<4; i++)
+        jump[i] = offset >> (8*i);
+}
+
+/* Leaves the block after count instructions. The exception raised is in eax
+ * if with_result, none otherwise.
+ */
+static void emit_exit(jit_emitter *e, uint32_t count, int with_result) {
+    int32_t offset;
+
+    if (with_result) {
+        emit8(e, 0x41); emit8(e, 0x89); emit8(e, 0x45); emit8(e, 0x00);
+    } else {
+        emit8(e, 0x41); emit8(e, 0xC7); emit8(e, 0x45); emit8(e, 0x00);
+        emit32(e, 0);
+    }
+    emit_mov_imm(e, EAX, count);
+    emit8(e, 0xE9);
+    offset = e->epilogue - (e->pos + 4);
+    emit32(e, offset);
+}
+
+/* Skips the instruction if its condition does not hold, returns the jump to
+ * patch at its end
+ */
+static uint8_t *emit_condition(jit_emitter *e, arm_decoded_instruction *d) {
+    emit_load(e, EAX, CPSR);
+    emit_shift(e, EXT_SHR, EAX, 28);
+    emit8(e, 0x48);                     /* movabs rcx, table */
+    emit8(e, 0xB9);
+    emit64(e, (uint64_t) &arm_decode_condition[d->cond << 4]);
+    emit8(e, 0x0F); emit8(e, 0xB6);     /* movzx eax, byte [rcx+rax] */
+    emit8(e, 0x04); emit8(e, 0x01);
+    emit_alu(e, X86_TEST, EAX, EAX);
+    return emit_jcc(e, CC_E);
+}
+
+/* Same computation of the flags as arm_flags_evaluate for a subtraction
+ * res = a-b
+ */
+static uint32_t arm_jit_sub_flags(uint32_t a, uint32_t b, uint32_t res,
+                                  uint32_t cpsr) {
+    uint32_t carry, overflow;
+
+    arm_alu_sub(a, b, 1, &carry, &overflow);
+    cpsr &= 0x0FFFFFFF;
+    if (get_bit(res, 31))
+        cpsr = set_bit(cpsr, N);
+    if (res == 0)
+        cpsr = set_bit(cpsr, Z);
+    return cpsr | (carry << C) | (overflow << V);
+}
+
+static int jit_supported_dp(arm_decoded_instruction *d) {
+    if ((d->kind != ARM_KIND_DATA_PROCESSING_SHIFT) &&
+        (d->kind != ARM_KIND_DATA_PROCESSING_IMMEDIATE))
+        return 0;
+    switch (d->opcode) {
+      case 0b0010: // SUB
+      case 0b0011: // RSB
+      case 0b0100: // ADD
+      case 0b1010: // CMP
+      case 0b1011: // CMN
+      case 0b1101: // MOV
+      case 0b1111: // MVN
+        break;
+      default:
+        return 0;
+    }
+    if ((d->rd == 15) || (d->rn == 15))
+        return 0;
+    if (d->kind == ARM_KIND_DATA_PROCESSING_SHIFT) {
+        /* Register shifted by a non zero immediate, or LSL #0 (a shift by 0
+         * encodes LSR #32, ASR #32 or RRX)
+         */
+        if ((d->rm == 15) || get_bit(d->shift, 0) ||
+            ((d->shift_imm == 0) && (d->shift != 0)))
+            return 0;
+        /* MOVS and MVNS take the shifter carry out, only kept unchanged */
+        return !d->s || (d->shift_imm == 0) ||
+               ((d->opcode != 0b1101) && (d->opcode != 0b1111));
+    }
+    /* Same thing for an immediate, whose carry out is unchanged if it is not
+     * rotated
+     */
+    return !d->s || (d->rs == 0) ||
+           ((d->opcode != 0b1101) && (d->opcode != 0b1111));
+}
+
+static int jit_supported_load_store(arm_decoded_instruction *d) {
+    if (get_bits(d->ins, 27, 25) != 2)
+        return 0;
+    if (!p(d->ins) && w(d->ins))
+        return 0;
+    return !(get_bit(d->ins, 20) && (d->rd == 15));
+}
+
+static int jit_supported_branch(arm_decoded_instruction *d) {
+    return get_bits(d->ins, 27, 25) == 5;
+}
+
+/* N and Z from res in edx, ored with the C and V computed in esi, then
+ * merged into the cpsr
+ */
+static void emit_nz_flags(jit_emitter *e, uint32_t kept) {
+    emit_alu(e, X86_MOV, EAX, EDX);
+    emit_alu_imm(e, EXT_AND, EAX, 0x80000000);
+    emit_alu(e, X86_OR, ESI, EAX);
+    emit_alu(e, X86_TEST, EDX, EDX);
+    emit8(e, 0x0F); emit8(e, 0x94); emit8(e, 0xC0);   /* setz al */
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);   /* movzx eax, al */
+    emit_shift(e, EXT_SHL, EAX, Z);
+    emit_alu(e, X86_OR, ESI, EAX);
+    emit_load(e, EAX, CPSR);
+    emit_alu_imm(e, EXT_AND, EAX, kept);
+    emit_alu(e, X86_OR, EAX, ESI);
+    emit_store(e, EAX, CPSR);
+}
+
+static void emit_data_processing(jit_emitter *e, arm_decoded_instruction *d) {
+    int test = (d->opcode == 0b1010) || (d->opcode == 0b1011);
+
+    /* shifter_operand in ecx, see arm_shifter_operand */
+    if (d->kind == ARM_KIND_DATA_PROCESSING_IMMEDIATE) {
+        emit_mov_imm(e, ECX, d->immediate);
+    } else {
+        emit_load(e, ECX, d->rm);
+        if (d->shift_imm > 0) {
+            switch (d->shift >> 1) {
+              case LSL: emit_shift(e, EXT_SHL, ECX, d->shift_imm); break;
+              case LSR: emit_shift(e, EXT_SHR, ECX, d->shift_imm); break;
+              case ASR: emit_shift(e, EXT_SAR, ECX, d->shift_imm); break;
+              case ROR: emit_shift(e, EXT_ROR, ECX, d->shift_imm); break;
+            }
+        }
+    }
+    /* Rn in eax, result in edx */
+    if ((d->opcode != 0b1101) && (d->opcode != 0b1111))
+        emit_load(e, EAX, d->rn);
+    switch (d->opcode) {
+      case 0b1101: // MOV
+        emit_alu(e, X86_MOV, EDX, ECX);
+        break;
+      case 0b1111: // MVN
+        emit_alu(e, X86_MOV, EDX, ECX);
+        emit_not(e, EDX);
+        break;
+      case 0b0100: // ADD
+      case 0b1011: // CMN
+        emit_alu(e, X86_MOV, EDX, EAX);
+        emit_alu(e, X86_ADD, EDX, ECX);
+        break;
+      case 0b0010: // SUB
+      case 0b1010: // CMP
+        emit_alu(e, X86_MOV, EDX, EAX);
+        emit_alu(e, X86_SUB, EDX, ECX);
+        break;
+      case 0b0011: // RSB
+        emit_alu(e, X86_MOV, EDX, ECX);
+        emit_alu(e, X86_SUB, EDX, EAX);
+        emit8(e, 0x91);     /* xchg eax, ecx : a = shifter_operand, b = Rn */
+        break;
+    }
+    if (!test)
+        emit_store(e, EDX, d->rd);
+    if (!d->s && !test)
+        return;
+
+    switch (d->opcode) {
+      case 0b1101: // MOV
+      case 0b1111: // MVN
+        emit_alu(e, X86_XOR, ESI, ESI);
+        emit_nz_flags(e, 0x3FFFFFFF);
+        break;
+      case 0b0100: // ADD
+      case 0b1011: // CMN
+        /* There is a carry out if res < a: esi = -carry, then masked */
+        emit_alu(e, X86_CMP, EDX, EAX);
+        emit_alu(e, X86_SBB, ESI, ESI);
+        emit_alu_imm(e, EXT_AND, ESI, 1 << C);
+        /* V = (a ^ res) & (b ^ res) */
+        emit_alu(e, X86_XOR, EAX, EDX);
+        emit_alu(e, X86_XOR, ECX, EDX);
+        emit_alu(e, X86_AND, EAX, ECX);
+        emit_alu_imm(e, EXT_AND, EAX, 0x80000000);
+        emit_shift(e, EXT_SHR, EAX, 31 - V);
+        emit_alu(e, X86_OR, ESI, EAX);
+        emit_nz_flags(e, 0x0FFFFFFF);
+        break;
+      default: // SUB, RSB, CMP
+        emit_alu(e, X86_MOV, EDI, EAX);
+        emit_alu(e, X86_MOV, ESI, ECX);
+        emit8(e, 0x8B);     /* mov ecx, cpsr */
+        emit_modrm(e, 2, ECX, EBX);
+        emit32(e, reg_disp(e, CPSR));
+        emit_call(e, arm_jit_sub_flags);
+        emit_store(e, EAX, CPSR);
+    }
+}
+
+/* Instructions of the running block already added to the cycle count of the
+ * core. Loads and stores bring the count up to date before their access, that
+ * may reach a device reading it, as arm_fetch would have left it.
+ */
+static uint32_t cycles_added;
+
+static void arm_jit_sync_cycles(arm_core p, uint32_t count) {
+    arm_add_cycles(p, count - cycles_added);
+    cycles_added = count;
+}
+
+/* The address is computed as in addrmode_load_store and the access itself is
+ * done by executeInstr_word_byte
+ */
+static void emit_load_store(jit_emitter *e, arm_block *b, int i) {
+    arm_decoded_instruction *d = &b->ops[i];
+    uint32_t offset = d->immediate;
+    uint8_t *next;
+
+    emit8(e, 0x4C); emit8(e, 0x89); emit8(e, 0xE7);   /* mov rdi, r12 */
+    emit_mov_imm(e, ESI, i + 1);
+    emit_call(e, arm_jit_sync_cycles);
+    if (d->rn == 15) {
+        uint32_t address = d->address + 8;
+        if (p(d->ins))
+            address = op(d->ins, address, offset);
+        emit_mov_imm(e, EDX, address);
+    } else {
+        emit_load(e, EDX, d->rn);
+        if (p(d->ins) && offset)
+            emit_alu_imm(e, get_bit(d->ins, 23) ? EXT_ADD : EXT_SUB, EDX,
+                         offset);
+    }
+    emit8(e, 0x4C); emit8(e, 0x89); emit8(e, 0xE7);   /* mov rdi, r12 */
+    emit_mov_imm(e, ESI, d->ins);
+    emit_call(e, executeInstr_word_byte);
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);   /* movzx eax, al */
+    emit_alu(e, X86_TEST, EAX, EAX);
+    next = emit_jcc(e, CC_E);
+    emit_exit(e, i + 1, 1);
+    patch(e, next);
+    if (!get_bit(d->ins, 20)) {
+        /* A store may have modified the block itself */
+        emit_mov_rax_imm64(e, (uint64_t) &b->valid);
+        emit8(e, 0x83); emit8(e, 0x38); emit8(e, 0x00); /* cmp [rax], 0 */
+        next = emit_jcc(e, CC_NE);
+        emit_exit(e, i + 1, 0);
+        patch(e, next);
+    }
+}
+
+/* Same computation of the target as arm_branch */
+static void emit_branch(jit_emitter *e, arm_decoded_instruction *d, int i) {
+    int32_t offset = get_bits(d->ins, 23, 0);
+
+    if (get_bit(d->ins, 23))
+        offset -= 1 << 24;
+    if (get_bit(d->ins, 24))
+        emit_store_imm(e, 14, d->address + 4);
+    emit_store_imm(e, 15, d->address + 8 + (offset << 2));
+    emit_exit(e, i + 1, 0);
+}
+
+static int arena_protect(int writable) {
+    if (writable == arena_writable)
+        return 0;
+    if (mprotect(arena, JIT_ARENA_SIZE,
+                 writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC))
+        return -1;
+    arena_writable = writable;
+    return 0;
+}
+
+static void *arm_jit_translate(arm_core p, arm_block *b) {
+    jit_emitter e;
+    uint8_t *start, *skip;
+    int i;
+
+    if (arena_used + JIT_MAX_BLOCK_SIZE > JIT_ARENA_SIZE) {
+        debug("Translation arena full, dropping all translations\n");
+        arena_used = 0;
+        generation++;
+    }
+    if (arena_protect(1))
+        return NULL;
+    init_decode_condition();
+    e.p = p;
+    start = e.pos = arena + arena_used;
+
+    /* The common epilogue is placed first, so that exits can jump back to it
+     */
+    e.epilogue = e.pos;
+    emit8(&e, 0x41); emit8(&e, 0x5F);    /* pop r15 */
+    emit8(&e, 0x41); emit8(&e, 0x5E);    /* pop r14 */
+    emit8(&e, 0x41); emit8(&e, 0x5D);    /* pop r13 */
+    emit8(&e, 0x41); emit8(&e, 0x5C);    /* pop r12 */
+    emit8(&e, 0x5B);                     /* pop rbx */
+    emit8(&e, 0xC3);                     /* ret */
+
+    /* Entry point */
+    start = e.pos;
+    emit8(&e, 0x53);                     /* push rbx */
+    emit8(&e, 0x41); emit8(&e, 0x54);    /* push r12 */
+    emit8(&e, 0x41); emit8(&e, 0x55);    /* push r13 */
+    emit8(&e, 0x41); emit8(&e, 0x56);    /* push r14 */
+    emit8(&e, 0x41); emit8(&e, 0x57);    /* push r15 */
+    emit8(&e, 0x48); emit8(&e, 0x89); emit8(&e, 0xFB);    /* mov rbx, rdi */
+    emit8(&e, 0x49); emit8(&e, 0x89); emit8(&e, 0xF4);    /* mov r12, rsi */
+    emit8(&e, 0x49); emit8(&e, 0x89); emit8(&e, 0xD5);    /* mov r13, rdx */
+
+    for (i=0; i<b->length; i++) {
+        arm_decoded_instruction *d = &b->ops[i];
+        int supported = jit_supported_dp(d) ? 1 :
+                        jit_supported_load_store(d) ? 2 :
+                        jit_supported_branch(d) ? 3 : 0;
+
+        if (!supported)
+            break;
+        skip = (d->cond < 0b1110) ? emit_condition(&e, d) : NULL;
+        switch (supported) {
+          case 1:
+            emit_data_processing(&e, d);
+            break;
+          case 2:
+            /* executeInstr_word_byte may read the pc */
+            emit_store_imm(&e, 15, d->address + 4);
+            emit_load_store(&e, b, i);
+            break;
+          case 3:
+            emit_branch(&e, d, i);
+            break;
+        }
+        if (skip)
+            patch(&e, skip);
+    }
+    if (i == 0)
+        return NULL;
+    emit_store_imm(&e, 15, b->ops[i-1].address + 4);
+    emit_exit(&e, i, 0);
+
+    arena_used = e.pos - arena;
+    b->native_mode = arm_get_mode(p);
+    b->native_generation = generation;
+    debug("Block %08x translated, %d out of %d instructions\n", b->address, i,
+          b->length);
+    return start;
+}
+
+int arm_jit_enable() {
+    if (!arena) {
+        arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) {
+            arena = NULL;
+            return -1;
+        }
+    }
+    jit_enabled = 1;
+    return 0;
+}
+
+int arm_jit_execute(arm_core p, arm_block *b, int *result) {
+    uint32_t executed;
+
+    *result = 0;
+    if (!jit_enabled || trace_has(MEMORY | REGISTERS | STATE | POSITION))
+        return 0;
+    if (b->native && ((b->native_generation != generation) ||
+                      (b->native_mode != arm_get_mode(p)))) {
+        b->native = NULL;
+        b->hits = 0;
+    }
+    if (!b->native) {
+        if (b->hits++ != JIT_THRESHOLD)
+            return 0;
+        b->native = arm_jit_translate(p, b);
+        if (!b->native)
+            return 0;
+    }
+    if (arena_protect(0))
+        return 0;
+    cycles_added = 0;
+    executed = ((arm_native_block) b->native)(arm_get_register_storage(p), p,
+                                              result);
+    arm_add_cycles(p, executed - cycles_added);
+    return executed;
+}
+
+#else
+
+int arm_jit_enable() {
+    return -1;
+}
+
+int arm_jit_execute(arm_core p, arm_block *b, int *result) {
+    *result = 0;
+    return 0;
+}
+
+#endif
+
+int arm_jit_enabled() {
+    return jit_enabled;
+}
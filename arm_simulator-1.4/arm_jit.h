@@ -0,0 +1,48 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __ARM_JIT_H__
+#define __ARM_JIT_H__
+#include <stdint.h>
+#include "arm_core.h"
+#include "arm_block_cache.h"
+
+/* Optional dynamic translator of basic blocks into native x86-64 code. Once a
+ * block has been executed JIT_THRESHOLD times in block mode, its longest
+ * prefix made of supported instructions (data processing MOV, MVN, ADD, SUB,
+ * RSB, CMP, CMN with an immediate or an immediately shifted register, LDR,
+ * STR, LDRB, STRB with an immediate offset, B and BL) is translated. The
+ * remaining instructions are left to the interpreter. Translated code behaves
+ * exactly as the interpreter, but does not produce any trace: it is only used
+ * when tracing is disabled.
+ */
+int arm_jit_enable();
+int arm_jit_enabled();
+
+/* Executes the native translation of b (translating it if it became hot) and
+ * returns the number of instructions of b executed this way, 0 if b has no
+ * translation. *result receives the exception raised by the last executed
+ * instruction, if any.
+ */
+int arm_jit_execute(arm_core p, arm_block *b, int *result);
+
+#endif
@@ -20,12 +20,12 @@ Contact: Guillaume.Huard@imag.fr
 	 700 avenue centrale, domaine universitaire
 	 38401 Saint Martin d'Hères
 */
-#include <assert.h>
 #include "arm_load_store.h"
 #include "arm_exception.h"
 #include "arm_constants.h"
 #include "util.h"
 #include "debug.h"
+#include "trace.h"
 
 
 /* Instructions implémentées :
@@ -34,6 +34,8 @@ avec arm_load_store :
 	miscellaneous : LDRH, STRH, LDRD, STRD
 avec arm_load_store_multiple :
 	LDM(1), STM(1)
+avec arm_swap :
+	SWP, SWPB
 */
 
 /* Retourne TRUE si l’état des flags N, Z, C et V 
@@ -251,6 +253,38 @@ uint8_t executeInstr_word_byte(arm_core proc, uint32_t ins, uint32_t address) {
 	return 0;
 }
 
+// Chargement du PC par LDM, le bit 0 du mot donne le bit T du CPSR
+static void load_pc(arm_core proc, uint32_t word) {
+	uint32_t cpsr = arm_read_cpsr(proc);
+
+	cpsr = get_bit(word, 0) ? set_bit(cpsr, 5) : clr_bit(cpsr, 5);
+	arm_write_cpsr(proc, cpsr);
+	arm_write_register(proc, 15, word & 0xFFFFFFFE);
+}
+
+/* Transfert de tous les registres en une seule copie, la plage d'adresses
+n'étant vérifiée qu'une fois. Retourne -1 sans rien transférer si elle sort
+de la mémoire : le transfert mot à mot s'arrête alors au bon mot */
+static int transfer_multiple(arm_core proc, uint32_t registers, uint8_t l, uint32_t start_address) {
+	uint32_t words[16];
+	uint8_t i, count = 0;
+
+	if(l) {
+		if(arm_read_words(proc, start_address, words, nb_set_bits(registers)))
+			return -1;
+		for(i = 0; i <= 14; i++)
+			if(get_bit(registers, i))
+				arm_write_register(proc, i, words[count++]);
+		if(get_bit(registers, 15))
+			load_pc(proc, words[count]);
+		return 0;
+	}
+	for(i = 0; i <= 15; i++)
+		if(get_bit(registers, i))
+			words[count++] = arm_read_register(proc, i);
+	return arm_write_words(proc, start_address, words, count);
+}
+
 uint8_t executeInstr_multiple(arm_core proc, uint32_t ins, uint32_t start_address, uint32_t end_address) {
 	uint8_t i;
 	uint8_t pc_nb = 15;
@@ -259,6 +293,12 @@ uint8_t executeInstr_multiple(arm_core proc, uint32_t ins, uint32_t start_addres
     uint32_t address;
 	uint8_t res = 0;
 
+	/* Les traces d'une copie en bloc donneraient tous les accès mémoire avant
+	ceux aux registres, elles sont produites dans l'ordre par le transfert mot
+	à mot */
+	if(!trace_has(MEMORY | REGISTERS) && !transfer_multiple(proc, registers, l, start_address))
+		return 0;
+
 	if(l) { // LDM -  Voir doc A4-36
 		uint32_t word;
 		uint8_t pc = get_bit(registers, pc_nb);
@@ -274,18 +314,8 @@ uint8_t executeInstr_multiple(arm_core proc, uint32_t ins, uint32_t start_addres
 		}
 		if(pc && !res) {
 			res = arm_read_word(proc, address, &word);
-			uint8_t temp = get_bit(word, 0);
-			uint32_t cpsr = arm_read_cpsr(proc);
-			if (temp != -1) {
-        		cpsr = (temp == 1) ? set_bit(cpsr, 5) : clr_bit(cpsr, 5);
-    			arm_write_cpsr(proc, cpsr);
-			}
-			arm_write_register(proc, pc_nb, word & 0xFFFFFFFE);
-			address += 4;
+			if(!res) load_pc(proc, word);
 		}
-		printf("%x",end_address);
-		assert(end_address == (address - 4));
-
 	}
 	else { // STM -  Voir doc A4-189
 		address = start_address;
@@ -297,7 +327,6 @@ uint8_t executeInstr_multiple(arm_core proc, uint32_t ins, uint32_t start_addres
 				}
 			}
 		}
-		assert(end_address == (address - 4));
 	}
 
     return res;
@@ -349,6 +378,31 @@ int arm_load_store_multiple(arm_core proc, uint32_t ins) {
     return executeInstr_multiple(proc, ins, start_address, end_address);
 }
 
+// Échange entre un registre et la mémoire : SWP et SWPB, voir doc A4-212 et A4-214
+int arm_swap(arm_core proc, uint32_t ins) {
+	uint32_t address = arm_read_register(proc, get_bits(ins, 19, 16));
+	uint32_t value = arm_read_register(proc, get_bits(ins, 3, 0));
+	uint8_t rd = get_bits(ins, 15, 12);
+	uint32_t word;
+	uint8_t byte;
+	int res;
+
+	if(get_bit(ins, 22)) { // SWPB
+		res = arm_read_byte(proc, address, &byte);
+		if(!res)
+			res = arm_write_byte(proc, address, value & 0xFF);
+		if(!res)
+			arm_write_register(proc, rd, byte);
+	} else { // SWP : le mot lu est tourné selon les bits de poids faible de l'adresse
+		res = arm_read_word(proc, address & 0xFFFFFFFC, &word);
+		if(!res)
+			res = arm_write_word(proc, address & 0xFFFFFFFC, value);
+		if(!res)
+			arm_write_register(proc, rd, get_bits(address, 1, 0)? ror(word, 8 * get_bits(address, 1, 0)) : word);
+	}
+	return res;
+}
+
 int arm_coprocessor_load_store(arm_core proc, uint32_t ins) {
     /* Not implemented */
     return UNDEFINED_INSTRUCTION;
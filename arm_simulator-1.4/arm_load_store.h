@@ -35,6 +35,8 @@ avec arm_load_store :
 	miscellaneous : LDRH, STRH, LDRD, STRD
 avec arm_load_store_multiple :
 	LDM(1), STM(1)
+avec arm_swap :
+	SWP, SWPB
 */
 
 /* Retourne TRUE si l’état des flags N, Z, C et V 
@@ -67,6 +69,7 @@ uint8_t executeInstr_multiple(arm_core proc, uint32_t ins, uint32_t start_addres
 /* Fonctions main du fichier load_store appellées dans arm_instructions */
 int arm_load_store(arm_core p, uint32_t ins);
 int arm_load_store_multiple(arm_core p, uint32_t ins);
+int arm_swap(arm_core p, uint32_t ins);
 int arm_coprocessor_load_store(arm_core p, uint32_t ins);
 
 
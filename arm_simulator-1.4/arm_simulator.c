@@ -21,14 +21,23 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hères
 */
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <getopt.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include "csapp.h"
 #include "scanner.h"
 #include "arm.h"
 #include "memory.h"
+#include "loader.h"
+#include "devices.h"
+#include "fork_server.h"
 #include "gdb_protocol.h"
 #include "trace.h"
+#include "arm_jit.h"
 #include "debug.h"
 
 struct shared_data {
@@ -99,8 +108,13 @@ static void *irq_listener(void *arg) {
         connection = Accept(server.socket, (struct sockaddr *) &peer,
                             &peer_length);
         while (Read(connection, &irq, 1) > 0) {
+            /* Makes a running continue command release the lock until the
+             * irq has been raised
+             */
+            arm_request_stop(shared->arm);
             pthread_mutex_lock(&shared->lock);
             arm_exception(shared->arm, irq);
+            arm_stop_done(shared->arm);
             pthread_mutex_unlock(&shared->lock);
         }
         shutdown(connection, SHUT_RDWR);
@@ -110,11 +124,100 @@ static void *irq_listener(void *arg) {
     pthread_exit(NULL);
 }
 
+/* Loads file[@address] given to --load and starts from its entry point */
+static void load(struct shared_data *shared, char *image) {
+    char *at = strrchr(image, '@');
+    uint32_t address = 0, entry;
+
+    if (at) {
+        *at = '\0';
+        address = strtoul(at + 1, NULL, 0);
+    }
+    if (load_image(shared->mem, image, address, &entry))
+        exit(1);
+    arm_set_pc(shared->arm, entry);
+}
+
+static void print_fusion_stats() {
+    arm_print_fusion_stats(stderr);
+}
+
+/* Host counters output by --stats: page faults from getrusage and, where perf
+ * events are allowed, data TLB load misses counted from the start of the
+ * simulation (including the threads created later on).
+ */
+static memory stats_memory = NULL;
+static int stats_tlb_misses = -1;
+
+static void start_stats(memory mem) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    stats_tlb_misses = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    stats_memory = mem;
+}
+
+static void print_stats() {
+    struct rusage usage;
+    uint64_t misses;
+
+    if (stats_memory == NULL)
+        return;
+    memory_print_stats(stats_memory, stderr);
+    stats_memory = NULL;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "Host page faults: %ld minor, %ld major\n",
+            usage.ru_minflt, usage.ru_majflt);
+    if (stats_tlb_misses >= 0 &&
+        read(stats_tlb_misses, &misses, sizeof(misses)) == sizeof(misses))
+        fprintf(stderr, "Host dTLB load misses: %llu\n",
+                (unsigned long long) misses);
+    else
+        fprintf(stderr, "Host dTLB load misses: unavailable\n");
+}
+
+/* Parses the size given to --memory-size, with an optional k, m or g suffix */
+static size_t parse_size(char *text) {
+    char *end;
+    unsigned long long size = strtoull(text, &end, 0);
+
+    switch (*end) {
+      case 'g': case 'G':
+        size <<= 10;
+        /* fall through */
+      case 'm': case 'M':
+        size <<= 10;
+        /* fall through */
+      case 'k': case 'K':
+        size <<= 10;
+        end++;
+    }
+    if (*end || end == text || size == 0 || size > MEMORY_FULL_SIZE)
+        return 0;
+    return size;
+}
+
 void usage(char *name) {
     fprintf(stderr, "Usage:\n"
         "%s [ --help ] [ --gdb-port port ] [ --irq-port port ] "
         "[ --trace-file file ] [ --trace-registers ] [ --trace-memory ] "
-        "[ --trace-state ] [ --trace-position ] [ --debug filename ]\n\n"
+        "[ --trace-state ] [ --trace-position ] [ --debug filename ] "
+        "[ --engine jit|threaded|interp ] [ --fusion-stats ] "
+        "[ --load file[@address] ] [ --device name[@address] ] "
+        "[ --fork-server path ] [ --fork-at swi:number|address ] "
+        "[ --fork-budget cycles ] "
+        "[ --memory-size size ] [ --huge-pages transparent|explicit ] "
+        "[ --stats ] [ --endian big|little ]\n\n"
         "Start an ARMv5 instruction set simulator that acts as a gdb server "
         "and can receive interrupts. It is possible to specify on which ports "
         "the simulator listen to gdb client or irq sending program "
@@ -129,6 +232,42 @@ void usage(char *name) {
         " at which the access has been performed\n"
         "The debug switch enable selective reporting of debug messages on a "
         "per source file basis\n"
+        "The engine switch selects how the continue command runs instructions "
+        "when no trace is enabled: jit translates frequently executed blocks "
+        "into native code (x86-64 hosts only), threaded uses a direct threaded "
+        "interpreter, interp (default) interprets them block by block\n"
+        "The fusion stats switch outputs on exit how many times each kind of"
+        " pair of instructions fused within blocks has been executed\n"
+        "The load switch, that can be repeated, loads a file into memory "
+        "before gdb connects: the segments of an ELF file at their addresses,"
+        " any other file as a raw binary at the given address (default 0). "
+        "The pc is set to the entry point of the last file loaded (its "
+        "address for a raw binary). Files are mapped copy-on-write rather "
+        "than copied whenever possible\n"
+        "The device switch, that can be repeated, attaches a memory mapped "
+        "device at its default address or at the given one: uart, a console "
+        "UART reading stdin and writing stdout, or sysctl, a system control "
+        "block through which the guest reads the cycle count and exits the "
+        "simulator (see devices.h)\n"
+        "The fork server switch replaces the gdb server: the guest runs up to "
+        "the mark given by the fork at switch (default swi:0x123457), then "
+        "each connection to the Unix socket at path gets a run from there in "
+        "a fork of the simulator, with the input it sends, answered by the "
+        "exit status, cycle count and registers (see fork_server.h)\n"
+        "The fork budget switch sets how many cycles each run of the fork "
+        "server may take before it is answered as a timeout (default "
+        "0x40000000)\n"
+        "The memory size switch sets the size of the simulated memory, in "
+        "bytes or with a k, m or g suffix (default and at most 4g, the whole "
+        "address space). Pages are allocated one at a time when first written,"
+        " unless the huge pages switch reserves them at once in an anonymous "
+        "mapping backed by transparent huge pages or by explicit huge pages, "
+        "that must have been reserved on the host for the whole size\n"
+        "The stats switch outputs on exit the number of allocated pages and of "
+        "software TLB misses, and the host page faults and TLB misses\n"
+        "The endian switch sets the byte order of the simulated memory "
+        "(default big), which must match the one of the ELF files loaded and "
+        "of the gdb client\n"
         , name);
 }
 
@@ -137,8 +276,15 @@ int main(int argc, char *argv[]) {
     pthread_t gdb_thread;
     pthread_t irq_thread;
     void *result;
-    int opt;
+    int opt, i, image_count = 0, device_count = 0;
     FILE *trace_file;
+    char **images = malloc(argc * sizeof(char *));
+    char **devices = malloc(argc * sizeof(char *));
+    char *fork_path = NULL, *fork_mark = "swi:0x123457", *end;
+    uint32_t fork_budget = FORK_SERVER_BUDGET;
+    unsigned long long value;
+    size_t memory_size = MEMORY_FULL_SIZE;
+    int memory_backing = MEMORY_HEAP, stats = 0, big_endian = 1;
 
     struct option longopts[] = {
         { "gdb-port", required_argument, NULL, 'g' },
@@ -150,14 +296,25 @@ int main(int argc, char *argv[]) {
         { "trace-position", no_argument, NULL, 'p' },
         { "help", no_argument, NULL, 'h' },
         { "debug", required_argument, NULL, 'd' },
+        { "engine", required_argument, NULL, 'e' },
+        { "fusion-stats", no_argument, NULL, 'f' },
+        { "load", required_argument, NULL, 'l' },
+        { "device", required_argument, NULL, 'D' },
+        { "fork-server", required_argument, NULL, 'F' },
+        { "fork-at", required_argument, NULL, 'a' },
+        { "fork-budget", required_argument, NULL, 'b' },
+        { "memory-size", required_argument, NULL, 'M' },
+        { "huge-pages", required_argument, NULL, 'H' },
+        { "stats", no_argument, NULL, 'S' },
+        { "endian", required_argument, NULL, 'E' },
         { NULL, 0, NULL, 0 }
     };
 
     shared.gdb_port = 0;
     shared.irq_port = 0;
     trace_file = stdout;
-    while ((opt = getopt_long(argc, argv, "g:i:ht:rmspd:", longopts, NULL))
-           != -1) {
+    while ((opt = getopt_long(argc, argv, "g:i:ht:rmspd:e:fl:D:F:a:b:M:H:SE:",
+                              longopts, NULL)) != -1) {
         switch(opt) {
           case 'g':
             shared.gdb_port = atoi(optarg);
@@ -190,6 +347,76 @@ int main(int argc, char *argv[]) {
           case 'd':
             add_debug_to(optarg);
             break;
+          case 'e':
+            if (strcmp(optarg, "jit") == 0) {
+                if (arm_jit_enable() < 0)
+                    fprintf(stderr, "JIT not available on this host, "
+                                    "falling back to the interpreter\n");
+            } else if (strcmp(optarg, "threaded") == 0) {
+                arm_use_threaded_interpreter(1);
+            } else if (strcmp(optarg, "interp") != 0) {
+                fprintf(stderr, "Unknown engine %s\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+          case 'f':
+            atexit(print_fusion_stats);
+            break;
+          case 'l':
+            images[image_count++] = optarg;
+            break;
+          case 'D':
+            devices[device_count++] = optarg;
+            break;
+          case 'F':
+            fork_path = optarg;
+            break;
+          case 'a':
+            fork_mark = optarg;
+            break;
+          case 'b':
+            value = strtoull(optarg, &end, 0);
+            if (*end || end == optarg || value == 0 || value > UINT32_MAX) {
+                fprintf(stderr, "Invalid fork budget %s\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            fork_budget = value;
+            break;
+          case 'M':
+            memory_size = parse_size(optarg);
+            if (memory_size == 0) {
+                fprintf(stderr, "Invalid memory size %s\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+          case 'H':
+            if (strcmp(optarg, "transparent") == 0) {
+                memory_backing = MEMORY_HUGE;
+            } else if (strcmp(optarg, "explicit") == 0) {
+                memory_backing = MEMORY_HUGETLB;
+            } else {
+                fprintf(stderr, "Unknown huge pages kind %s\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+          case 'S':
+            stats = 1;
+            break;
+          case 'E':
+            if (strcmp(optarg, "big") == 0) {
+                big_endian = 1;
+            } else if (strcmp(optarg, "little") == 0) {
+                big_endian = 0;
+            } else {
+                fprintf(stderr, "Unknown endianess %s\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
           default:
             fprintf(stderr, "Unrecognized option %c\n", opt);
             usage(argv[0]);
@@ -200,17 +427,34 @@ int main(int argc, char *argv[]) {
     arm_init();
     set_trace_file(trace_file);
 
-#ifdef BIG_ENDIAN_SIMULATOR
-    shared.mem = memory_create(0x20000, 1);
-#else
-    shared.mem = memory_create(0x20000, 0);
-#endif
+    shared.mem = memory_create_backed(memory_size, big_endian, memory_backing);
+    if (shared.mem == NULL) {
+        perror("Simulated memory");
+        exit(1);
+    }
+    if (stats) {
+        start_stats(shared.mem);
+        atexit(print_stats);
+    }
     shared.arm = arm_create(shared.mem);
+    for (i = 0; i < device_count; i++)
+        if (device_attach(shared.arm, shared.mem, devices[i]))
+            exit(1);
+    free(devices);
+    for (i = 0; i < image_count; i++)
+        load(&shared, images[i]);
+    free(images);
+    if (fork_path) {
+        fork_server(shared.arm, shared.mem, fork_path, fork_mark,
+                    fork_budget);
+        exit(1);
+    }
 
     pthread_mutex_init(&shared.lock, NULL);
     pthread_create(&gdb_thread, NULL, gdb_listener, &shared);
     pthread_create(&irq_thread, NULL, irq_listener, &shared);
     pthread_join(gdb_thread, &result);
+    print_stats();
     arm_destroy(shared.arm);
     memory_destroy(shared.mem);
     return 0;
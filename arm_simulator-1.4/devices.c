@@ -0,0 +1,166 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "devices.h"
+
+#define UART_DATA               0x00
+#define UART_FLAGS              0x18
+#define UART_FLAGS_RX_EMPTY     (1 << 4)
+#define UART_FLAGS_TX_EMPTY     (1 << 7)
+
+#define SYSCTL_ID_REGISTER      0x00
+#define SYSCTL_CYCLES           0x04
+#define SYSCTL_EXIT             0x08
+
+struct uart {
+    int input, output;
+    int pending; /* next input byte, -1 until one is read */
+};
+
+/* Reads the next input byte, without waiting, unless one is already pending */
+static int uart_receive(struct uart *uart) {
+    struct pollfd input = { uart->input, POLLIN, 0 };
+    unsigned char byte;
+
+    if (uart->pending < 0 && poll(&input, 1, 0) > 0 &&
+        read(uart->input, &byte, 1) == 1)
+        uart->pending = byte;
+    return uart->pending >= 0;
+}
+
+static int uart_read(void *data, uint32_t offset, int size, uint32_t *value) {
+    struct uart *uart = data;
+
+    (void) size; /* The registers read the same whatever the size */
+    switch (offset) {
+      case UART_DATA:
+        *value = uart_receive(uart) ? uart->pending : 0;
+        uart->pending = -1;
+        return 0;
+      case UART_FLAGS:
+        *value = UART_FLAGS_TX_EMPTY |
+                 (uart_receive(uart) ? 0 : UART_FLAGS_RX_EMPTY);
+        return 0;
+      default:
+        return -1;
+    }
+}
+
+static int uart_write(void *data, uint32_t offset, int size, uint32_t value) {
+    struct uart *uart = data;
+    unsigned char byte = value;
+
+    (void) size;
+    if (offset != UART_DATA)
+        return -1;
+    return write(uart->output, &byte, 1) == 1 ? 0 : -1;
+}
+
+static void *uart_create(arm_core p) {
+    struct uart *uart = malloc(sizeof(struct uart));
+
+    (void) p;
+    if (uart) {
+        uart->input = STDIN_FILENO;
+        uart->output = STDOUT_FILENO;
+        uart->pending = -1;
+    }
+    return uart;
+}
+
+static const struct memory_device_ops uart_ops = {
+    uart_read, uart_write, free,
+    MEMORY_DEVICE_BYTE | MEMORY_DEVICE_HALF | MEMORY_DEVICE_WORD
+};
+
+static int sysctl_read(void *data, uint32_t offset, int size, uint32_t *value) {
+    (void) size; /* Only word accesses reach the device */
+    switch (offset) {
+      case SYSCTL_ID_REGISTER:
+        *value = SYSCTL_ID;
+        return 0;
+      case SYSCTL_CYCLES:
+        *value = arm_get_cycle_count(data);
+        return 0;
+      default:
+        return -1;
+    }
+}
+
+static int sysctl_write(void *data, uint32_t offset, int size, uint32_t value) {
+    (void) size;
+    if (offset != SYSCTL_EXIT)
+        return -1;
+    arm_exit(data, value);
+    return 0;
+}
+
+static void *sysctl_create(arm_core p) {
+    return p;
+}
+
+static const struct memory_device_ops sysctl_ops = {
+    sysctl_read, sysctl_write, NULL, MEMORY_DEVICE_WORD
+};
+
+static struct {
+    char *name;
+    uint32_t base;
+    const struct memory_device_ops *ops;
+    void *(*create)(arm_core p);
+} device_types[] = {
+    { "uart", UART_BASE, &uart_ops, uart_create },
+    { "sysctl", SYSCTL_BASE, &sysctl_ops, sysctl_create },
+};
+
+int device_attach(arm_core p, memory mem, char *description) {
+    char *at = strrchr(description, '@');
+    size_t length = at ? (size_t) (at - description) : strlen(description);
+    uint32_t base;
+    void *data;
+    size_t i;
+
+    for (i = 0; i < sizeof(device_types) / sizeof(device_types[0]); i++) {
+        if (strlen(device_types[i].name) != length ||
+            strncmp(device_types[i].name, description, length) != 0)
+            continue;
+        base = at ? strtoul(at + 1, NULL, 0) : device_types[i].base;
+        data = device_types[i].create(p);
+        if (data == NULL ||
+            memory_add_device(mem, base, MEMORY_PAGE_SIZE, device_types[i].ops,
+                              data)) {
+            fprintf(stderr, "%s: cannot attach device at 0x%08X\n",
+                    description, base);
+            if (data && device_types[i].ops->destroy)
+                device_types[i].ops->destroy(data);
+            return -1;
+        }
+        return 0;
+    }
+    fprintf(stderr, "%s: unknown device\n", description);
+    return -1;
+}
@@ -0,0 +1,52 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __DEVICES_H__
+#define __DEVICES_H__
+#include <stdint.h>
+#include "arm_core.h"
+#include "memory.h"
+
+/* Registry of the stock memory mapped devices (see memory_add_device), that
+ * let a guest do I/O by itself:
+ * - uart (default base 0xF0000000), a console UART with the data and flag
+ *   registers of a PL011: writing the data register (offset 0x00) outputs a
+ *   byte on stdout, reading it gives the next byte of stdin (0 if none). In
+ *   the flag register (offset 0x18), bit 4 is set while no input byte is
+ *   available and bit 7 tells that the output is always empty,
+ * - sysctl (default base 0xF0001000), a system control block with an
+ *   identification register (offset 0x00, reads as SYSCTL_ID), the low 32 bits
+ *   of the cycle count (offset 0x04) and an exit register (offset 0x08),
+ *   writing a value there ends the simulator with this value as exit status
+ *   (see arm_exit).
+ */
+#define UART_BASE   0xF0000000
+#define SYSCTL_BASE 0xF0001000
+#define SYSCTL_ID   0x41524D35 /* "ARM5" */
+
+/* Attaches to mem the device described as name[@address] (default base when
+ * no address is given), p being the core that uses it. Returns 0 on success,
+ * -1 otherwise after printing the reason on stderr.
+ */
+int device_attach(arm_core p, memory mem, char *description);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "fork_server.h"
+#include "arm_instruction.h"
+#include "csapp.h"
+#include "trace.h"
+
+/* Instructions run by each call to arm_run */
+#define FORK_SERVER_CHUNK 0x100000
+
+/* Connection of the run served by this process (in a child) */
+static int connection;
+
+static void fork_server_report(arm_core p, char *reason, int status) {
+    char report[256];
+    int length, i;
+
+    trace_disable();
+    length = snprintf(report, sizeof(report), "%s %d cycles %u", reason,
+                      status, arm_get_cycle_count(p));
+    for (i = 0; i < 15; i++)
+        length += snprintf(report + length, sizeof(report) - length,
+                           " r%d %08X", i, arm_read_register(p, i));
+    length += snprintf(report + length, sizeof(report) - length,
+                       " pc %08X cpsr %08X\n", arm_get_pc(p), arm_get_cpsr(p));
+    Rio_writen(connection, report, length);
+}
+
+static void fork_server_exit(arm_core p, int status) {
+    fork_server_report(p, "exit", status);
+    fflush(NULL);
+    _exit(status);
+}
+
+/* Copies the input into the guest buffer, then runs until the guest exits
+ * (fork_server_exit) or budget cycles are spent
+ */
+static void fork_server_run(arm_core p, memory mem, uint32_t budget) {
+    uint32_t address = arm_read_register(p, 0);
+    uint32_t size = arm_read_register(p, 1), length = 0;
+    uint8_t buffer[MAXBUF], *span;
+    size_t available;
+    ssize_t count;
+    uint32_t start, elapsed;
+
+    /* The input is read straight into the buffer, up to its end or to the
+     * first byte that is not RAM, the rest is drained
+     */
+    while (length < size &&
+           (span = memory_write_span(mem, address + length, size - length,
+                                     &available)) &&
+           (count = Read(connection, span, available)) > 0)
+        length += count;
+    while (Read(connection, buffer, sizeof(buffer)) > 0)
+        continue;
+    arm_write_register(p, 1, length);
+    arm_set_exit_handler(p, fork_server_exit);
+    /* arm_run counts each instruction as a cycle */
+    start = arm_get_cycle_count(p);
+    while ((elapsed = arm_get_cycle_count(p) - start) < budget)
+        arm_run(p, min(budget - elapsed, FORK_SERVER_CHUNK), 0);
+    fork_server_report(p, "timeout", 0);
+    fflush(NULL);
+    _exit(0);
+}
+
+static int fork_server_at_mark(arm_core p, int swi, uint32_t mark) {
+    uint32_t ins;
+
+    if (!swi)
+        return arm_get_pc(p) == mark;
+    return arm_read_code(p, arm_get_pc(p), &ins) == 0 &&
+           ins == (0xEF000000 | mark);
+}
+
+int fork_server(arm_core p, memory mem, char *path, char *mark,
+                uint32_t budget) {
+    int swi = strncmp(mark, "swi:", 4) == 0;
+    uint32_t target = strtoul(swi ? mark + 4 : mark, NULL, 0), count;
+    struct sockaddr_un addr;
+    int listener, status;
+    pid_t pid;
+
+    for (count = 0; !fork_server_at_mark(p, swi, target); count++) {
+        if (count == FORK_SERVER_MARK_LIMIT) {
+            fprintf(stderr, "Mark %s not reached\n", mark);
+            return -1;
+        }
+        arm_step(p);
+    }
+    if (swi)
+        arm_set_pc(p, arm_get_pc(p) + 4);
+
+    listener = Socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    Bind(listener, (struct sockaddr *) &addr, sizeof(addr));
+    Listen(listener, LISTENQ);
+    fprintf(stderr, "Mark reached after %u instructions, serving runs on %s\n",
+            count, path);
+    while (1) {
+        fflush(NULL); /* Nothing buffered is to be output twice */
+        connection = Accept(listener, NULL, NULL);
+        pid = Fork();
+        if (pid == 0) {
+            Close(listener);
+            fork_server_run(p, mem, budget);
+        }
+        Waitpid(pid, &status, 0);
+        if (WIFSIGNALED(status))
+            dprintf(connection, "signal %d\n", WTERMSIG(status));
+        Close(connection);
+    }
+}
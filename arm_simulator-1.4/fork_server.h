@@ -0,0 +1,54 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __FORK_SERVER_H__
+#define __FORK_SERVER_H__
+#include "arm_core.h"
+#include "memory.h"
+
+/* Fork server: runs the guest once up to a marked point, which pays for its
+ * loading and boot, then serves runs from this point on the Unix socket at
+ * path. The mark is either "swi:number", the first swi with this number
+ * (with the always condition), skipped as if it had returned, or an address,
+ * reached when it is the next instruction. At the mark, r0 is expected to
+ * give the address of an input buffer and r1 its size.
+ * Each connection gets a run in a fork of the process as it is at the mark:
+ * the bytes sent by the client until it shuts down its side of the
+ * connection are copied into the buffer (truncated to its size, or to its
+ * first byte that is out of memory or in a device), r1 is set to the number
+ * of bytes copied and the guest runs until it exits (see arm_exit). The
+ * answer is then a line giving the exit status, the cycle count and the
+ * registers:
+ *   exit <status> cycles <count> r0 <hex> ... r14 <hex> pc <hex> cpsr <hex>
+ * where exit becomes timeout if the guest did not exit within budget cycles
+ * (FORK_SERVER_BUDGET by default), or the line is "signal <number>" if the
+ * run crashed the simulator. Runs are served one at a time.
+ * Returns only on failure to reach the mark within FORK_SERVER_MARK_LIMIT
+ * instructions, -1 after printing the reason.
+ */
+#define FORK_SERVER_BUDGET 0x40000000
+#define FORK_SERVER_MARK_LIMIT 0x40000000
+
+int fork_server(arm_core p, memory mem, char *path, char *mark,
+                uint32_t budget);
+
+#endif
@@ -22,6 +22,7 @@ Contact: Guillaume.Huard@imag.fr
 */
 #include <stdio.h>
 #include <assert.h>
+#include <time.h>
 #include "gdb_protocol.h"
 #include "debug.h"
 #include "csapp.h"
@@ -31,6 +32,14 @@ Contact: Guillaume.Huard@imag.fr
 #include "trace.h"
 
 #define MAX_PACKET_SIZE 1024
+/* Maximum number of instructions run by a call to arm_run in the continue
+ * command.
+ */
+#define CONT_BUDGET 0x100000
+/* Nominal speed of the simulated processor, in instructions per second. It
+ * converts the time spent sleeping in an idle loop into skipped iterations.
+ */
+#define IDLE_FREQUENCY 100000000
 
 struct gdb_protocol_data {
     arm_core arm;
@@ -73,23 +82,16 @@ static void gdb_send_data(gdb_protocol_data_t gdb, char *data) {
     gdb_send_buffer(gdb);
 }
 
-/* Read and write to/from a string of bytes (in hexadecimal) in local byte
- * order */
-static uint32_t read_uint32(char *data) {
+/* Read and write to/from a string of bytes (in hexadecimal) in the byte order
+ * of the simulated memory */
+static uint32_t read_uint32(gdb_protocol_data_t gdb, char *data) {
     unsigned int i, step, value;
-    int target_big_endian;
     union {
         unsigned char bytes[4];
         uint32_t integer;
     } mem;
 
-    #ifdef BIG_ENDIAN_SIMULATOR
-        target_big_endian = 1;
-    #else
-        target_big_endian = 0;
-    #endif
-
-    if (is_big_endian() == target_big_endian) {
+    if (is_big_endian() == memory_is_big_endian(gdb->mem)) {
         i = 0;
         step = 1;
     } else {
@@ -105,22 +107,15 @@ static uint32_t read_uint32(char *data) {
     return mem.integer;
 }
 
-static void write_uint32(char *data, uint32_t value) {
+static void write_uint32(gdb_protocol_data_t gdb, char *data, uint32_t value) {
     unsigned int i, step;
-    int target_big_endian;
     union {
         unsigned char bytes[4];
         uint32_t integer;
     } mem;
 
     mem.integer = value;
-    #ifdef BIG_ENDIAN_SIMULATOR
-        target_big_endian = 1;
-    #else
-        target_big_endian = 0;
-    #endif
-
-    if (is_big_endian() == target_big_endian) {
+    if (is_big_endian() == memory_is_big_endian(gdb->mem)) {
         i = 0;
         step = 1;
     } else {
@@ -156,35 +151,50 @@ static void cont(gdb_protocol_data_t gdb, char *data) {
     /* When the simulator doesn't implement breakpoints (as it is the case
      * here), gdb implements soft breakpoints by placing an architecturally
      * undefined instruction at breakpoint position. Thus we implement the
-     * continue command as a loop that waits for this instruction.
+     * continue command as a run that stops before this instruction. We will
+     * not execute it because we don't know whether exceptions are properly
+     * implemented or not. At this point gdb should replace the offending
+     * instruction by the original one. This is hack but should perform better
+     * than other solution because of its few assumptions.
      */
-    uint32_t instruction, r15;
-    int end = 0;
-
-    while (!end) {
-        /* We read in anticipation the next instruction to handle our special
-         * cases
+    int reason;
+    uint32_t done;
+
+    do {
+        reason = arm_run(gdb->arm, CONT_BUDGET,
+                         ARM_STOP_ON_BREAKPOINT | ARM_STOP_ON_IDLE);
+        /* Requests can only be done while we release the lock, so the count
+         * read here changes once the pending ones are done or, when idle, once
+         * a new one is
          */
-        trace_disable();
-        r15 = arm_read_register(gdb->arm, 15) - 4;
-        (void) arm_read_word(gdb->arm, r15, &instruction);
-        trace_enable(); 
-        switch (instruction & 0xFFF000F0) {
-          case 0xE7F000F0:
-            /* This is a breakpoint, we will not execute it because we don't
-             * know whether exceptions are properly implemented or not.
-             * At this point gdb should replace the offending instruction by
-             * the original one. This is hack but should perform better than
-             * other solution because of its few assumptions.
+        done = arm_get_stops_done(gdb->arm);
+        if (reason == ARM_RUN_STOP_REQUESTED) {
+            /* Gives the lock to the thread that requested the stop (for
+             * instance to raise an irq) until it is done
              */
-            end = 1;
-            break;
-          default:
-            gdb->target_exception = arm_step(gdb->arm);
-            trace_arm_state(gdb->arm);
+            pthread_mutex_unlock(gdb->lock);
+            arm_wait_stops_done(gdb->arm, done);
+            pthread_mutex_lock(gdb->lock);
+        } else if (reason == ARM_RUN_IDLE) {
+            /* Nothing happens until an irq: sleeps until one is raised, then
+             * accounts for the instructions that would have been run meanwhile
+             * (the irq may already have moved the pc out of the loop)
+             */
+            struct timespec start, end;
+            uint64_t elapsed;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            pthread_mutex_unlock(gdb->lock);
+            arm_wait_stops_done(gdb->arm, done);
+            pthread_mutex_lock(gdb->lock);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000 +
+                      end.tv_nsec - start.tv_nsec;
+            elapsed = elapsed * (IDLE_FREQUENCY / 1000000) / 1000;
+            arm_add_cycles(gdb->arm, elapsed > UINT32_MAX ? UINT32_MAX : elapsed);
         }
-    }
-
+    } while (reason != ARM_RUN_BREAKPOINT);
+    gdb->target_exception = arm_get_last_exception(gdb->arm);
     gdb_send_stop_reason(gdb);
 }
 
@@ -214,11 +224,11 @@ static void read_general_registers(gdb_protocol_data_t gdb, char *data) {
     position = gdb->buffer;
     /* General register r0..r14 */
     for (i=0; i<15; i++) {
-        write_uint32(position, arm_read_register(gdb->arm, i));
+        write_uint32(gdb, position, arm_read_register(gdb->arm, i));
         position += 8;
     }
     /* Special case, the pc is one instruction in advance (before fetch) */
-    write_uint32(position, arm_read_register(gdb->arm, i) - 4);
+    write_uint32(gdb, position, arm_read_register(gdb->arm, i) - 4);
     position += 8;
     /* Floating point register f0..f7 */
     /* Not implemented */
@@ -232,23 +242,44 @@ static void read_general_registers(gdb_protocol_data_t gdb, char *data) {
     /* fps not implemented */
     sprintf(position,"xxxxxxxx");
     position += 8;
-    write_uint32(position, arm_read_cpsr(gdb->arm));
+    write_uint32(gdb, position, arm_read_cpsr(gdb->arm));
     trace_enable();
     gdb_send_buffer(gdb);
 }
 
 static void read_memory(gdb_protocol_data_t gdb, char *data) {
+    static const char digits[] = "0123456789abcdef";
     unsigned int address, size;
+    const uint8_t *span;
+    size_t length, i;
     char *position;
     uint8_t value;
 
     sscanf(data,"%x,%x", &address, &size);
+    /* A shorter answer makes gdb ask for the rest ($, #, checksum, \0 aside) */
+    size = min(size, (MAX_PACKET_SIZE - 5) / 2);
+    if (address >= memory_get_size(gdb->mem))
+        size = 0;
+    else
+        size = min(size, memory_get_size(gdb->mem) - address);
     position = gdb->buffer;
-    position[0] = '\0';
-    while (size-- && (memory_read_byte(gdb->mem, address++, &value) != -1)) {
-        sprintf(position, "%02x", value);
-        position += 2;
+    while (size) {
+        span = memory_read_span(gdb->mem, address, size, &length);
+        if (span == NULL) {
+            /* Devices are read a byte at a time, up to a refused access */
+            if (memory_read_byte(gdb->mem, address, &value) == -1)
+                break;
+            span = &value;
+            length = 1;
+        }
+        for (i = 0; i < length; i++) {
+            *position++ = digits[span[i] >> 4];
+            *position++ = digits[span[i] & 0xF];
+        }
+        address += length;
+        size -= length;
     }
+    *position = '\0';
     gdb_send_buffer(gdb);
 }
 
@@ -257,8 +288,8 @@ static void read_register(gdb_protocol_data_t gdb, char *data) {
     reg = atoi(data);
     assert(reg < 16);
     trace_disable();
-    write_uint32(gdb->buffer, arm_read_register(gdb->arm, reg) -
-                              ((reg == 15) ? 4 : 0));
+    write_uint32(gdb, gdb->buffer, arm_read_register(gdb->arm, reg) -
+                                   ((reg == 15) ? 4 : 0));
     trace_enable();
     gdb_send_buffer(gdb);
 }
@@ -279,8 +310,8 @@ static void set_thread(gdb_protocol_data_t gdb, char *data) {
 }
 
 static void step(gdb_protocol_data_t gdb, char *data) {
-    gdb->target_exception = arm_step(gdb->arm);
-    trace_arm_state(gdb->arm);
+    (void) arm_run(gdb->arm, 1, 0);
+    gdb->target_exception = arm_get_last_exception(gdb->arm);
     gdb_send_stop_reason(gdb);
 }
 
@@ -293,7 +324,7 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     position = data;
     /* General register r0..r15 */
     for (i=0; i<16; i++) {
-        value = read_uint32(position);
+        value = read_uint32(gdb, position);
         arm_write_register(gdb->arm, i, value);
         debug("r%02d = %08x   ", i, value);
         if (i % 4 == 3)
@@ -305,7 +336,7 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     for (i=0; i<8; i++) {
         //printf("f%02d = ", i);
         for (j=0; j<3; j++) {
-            value = read_uint32(position);
+            value = read_uint32(gdb, position);
             //printf("%08x", value);
             position += 8;
         }
@@ -315,10 +346,10 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     }
     /* Status registers */
     /* fps not implemented */
-    value = read_uint32(position);
+    value = read_uint32(gdb, position);
     //printf("fps = %08x   ", value);
     position += 8;
-    value = read_uint32(position);
+    value = read_uint32(gdb, position);
     arm_write_cpsr(gdb->arm, value);
     debug("cpsr = %08x\n", value);
     trace_enable();
@@ -327,28 +358,29 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
 }
 
 static void write_memory_binary(gdb_protocol_data_t gdb, char *data) {
-    unsigned int address, size, i, write_ok;
+    unsigned int address, size, i;
     char *content;
-    uint8_t value;
+    uint8_t *value;
 
     sscanf(data,"%x,%x", &address, &size);
     content = index(data, ':') + 1;
     debug("Writing %d bytes at address %08x : ", size, address);
-    write_ok = address < memory_get_size(gdb->mem);
-    for (i=0; (i<size) && write_ok; i++) {
+    /* Unescapes the content in place, then writes it as a single block */
+    value = (uint8_t *) content;
+    for (i=0; i<size; i++) {
         if (*content == 0x7d) {
             content++;
-            value = *content ^ (char) 0x20;
+            value[i] = *content ^ (char) 0x20;
         } else {
-            value = *content;
+            value[i] = *content;
         }
-        write_ok = memory_write_byte(gdb->mem, address++, value) == 0;
         if (i<32)
-            debug_raw("%02x", value);
+            debug_raw("%02x", value[i]);
         content++;
     }
     debug_raw("...\n");
-    if (write_ok)
+    if ((address < memory_get_size(gdb->mem)) &&
+        (memory_write_block(gdb->mem, address, value, size) == 0))
         gdb_send_data(gdb, "OK");
     else
         gdb_send_data(gdb, "E02");
@@ -359,7 +391,7 @@ static void write_register(gdb_protocol_data_t gdb, char *data) {
 
     sscanf(data,"%x", &reg);
     data = index(data, '=') + 1;
-    value = read_uint32(data);
+    value = read_uint32(gdb, data);
     assert(reg < 16);
     trace_disable();
     arm_write_register(gdb->arm, reg, value);
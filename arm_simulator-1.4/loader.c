@@ -0,0 +1,106 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "util.h"
+
+/* Fields of the ELF headers are in the endianess of the file */
+static int elf_swap;
+
+static uint16_t elf_half(uint16_t value) {
+    return elf_swap ? reverse_2(value) : value;
+}
+
+static uint32_t elf_word(uint32_t value) {
+    return elf_swap ? reverse_4(value) : value;
+}
+
+static int load_elf(memory mem, char *filename, int fd, Elf32_Ehdr *header,
+                    uint32_t *entry) {
+    Elf32_Phdr segment;
+    uint32_t offset;
+    int i;
+
+    if (header->e_ident[EI_CLASS] != ELFCLASS32 ||
+        elf_half(header->e_machine) != EM_ARM) {
+        fprintf(stderr, "%s: not a 32 bits ARM ELF file\n", filename);
+        return -1;
+    }
+    if ((header->e_ident[EI_DATA] == ELFDATA2MSB) !=
+        memory_is_big_endian(mem)) {
+        fprintf(stderr, "%s: endianess differs from the simulated memory\n",
+                filename);
+        return -1;
+    }
+    for (i = 0; i < elf_half(header->e_phnum); i++) {
+        offset = elf_word(header->e_phoff) + i * elf_half(header->e_phentsize);
+        if (pread(fd, &segment, sizeof(segment), offset) != sizeof(segment)) {
+            fprintf(stderr, "%s: truncated program header\n", filename);
+            return -1;
+        }
+        if (elf_word(segment.p_type) != PT_LOAD || !segment.p_filesz)
+            continue;
+        if (memory_map_file(mem, elf_word(segment.p_paddr), fd,
+                            elf_word(segment.p_offset),
+                            elf_word(segment.p_filesz))) {
+            fprintf(stderr, "%s: cannot load segment at 0x%08X\n", filename,
+                    elf_word(segment.p_paddr));
+            return -1;
+        }
+    }
+    *entry = elf_word(header->e_entry);
+    return 0;
+}
+
+int load_image(memory mem, char *filename, uint32_t address, uint32_t *entry) {
+    Elf32_Ehdr header;
+    struct stat status;
+    int fd, result;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &status)) {
+        perror(filename);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.e_ident, ELFMAG, SELFMAG) == 0) {
+        elf_swap = (header.e_ident[EI_DATA] == ELFDATA2MSB) != is_big_endian();
+        result = load_elf(mem, filename, fd, &header, entry);
+    } else {
+        result = memory_map_file(mem, address, fd, 0, status.st_size);
+        if (result)
+            fprintf(stderr, "%s: does not fit in memory at 0x%08X\n",
+                    filename, address);
+        *entry = address;
+    }
+    /* The mapped pages remain valid once the file is closed */
+    close(fd);
+    return result;
+}
@@ -0,0 +1,40 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#ifndef __LOADER_H__
+#define __LOADER_H__
+#include <stdint.h>
+#include "memory.h"
+
+/* Loads the file filename into mem, mapping it rather than copying it when
+ * possible (see memory_map_file):
+ * - an ELF file has its PT_LOAD segments loaded at their physical addresses
+ *   and entry is set to its entry point,
+ * - any other file is loaded as a raw binary at address, which is then the
+ *   entry point.
+ * The memory is expected to be fresh: the part of a segment not given by the
+ * file (its bss) is left as it is, thus reading as zeros.
+ * Returns 0 on success, -1 otherwise after printing the reason on stderr.
+ */
+int load_image(memory mem, char *filename, uint32_t address, uint32_t *entry);
+
+#endif
@@ -20,23 +20,160 @@ Contact: Guillaume.Huard@imag.fr
 	 700 avenue centrale, domaine universitaire
 	 38401 Saint Martin d'Hères
 */
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memory.h"
 #include "util.h"
 
+#define MEMORY_PAGE_OFFSET(address) ((address) & (MEMORY_PAGE_SIZE - 1))
+#define MEMORY_TLB_INDEX(address) \
+                       (((address) >> MEMORY_PAGE_SHIFT) & (MEMORY_TLB_SIZE - 1))
+
+// Descripteur d'une page de la mémoire simulée
+struct memory_page {
+    uint8_t *host; // Contenu de la page, NULL tant qu'elle n'a pas été écrite
+    uint8_t watched; // Non nul si la page est surveillée
+    uint8_t modified; // Non nul si écrite depuis la capture ou sa restauration
+    struct memory_device *device; // Périphérique de la page, NULL pour la RAM
+    const uint8_t *saved; // Contenu lors de la capture, NULL si non conservé
+};
+
 struct memory_data {
-    uint8_t* values; // On utilise un pointeur et non un tableau car la taille n'est pas connue à l'avance
+    struct memory_tlb tlb; // Contient aussi le masque d'inversion des octets
+    /* Un descripteur par page de la mémoire simulée. La table est allouée
+     * par calloc : seules ses parties utilisées occupent de la mémoire réelle.
+     */
+    struct memory_page *pages;
+    uint64_t *dirty; // Un bit par page, mis à un par les écritures
     size_t size;
     int is_big_endian;
+    /* Projection anonyme réservée d'un bloc pour MEMORY_HUGE et
+     * MEMORY_HUGETLB (NULL pour MEMORY_HEAP) : chaque page simulée y a sa
+     * place, que l'hôte ne fournit qu'à la première écriture.
+     */
+    int backing;
+    uint8_t *arena;
+    size_t arena_length;
+    size_t allocated_pages;
+    uint64_t tlb_fills;
+    memory_watch_handler watch_handler;
+    void *watch_data;
+    struct memory_mapping *mappings; // Projections faites par memory_map_file
+    struct memory_device *devices; // Ajoutés par memory_add_device
+    uint32_t device_accesses;
+    /* Capture en cours (0 si aucune) et numéros des pages dont elle conserve
+     * le contenu, copié lors de leur première écriture (voir memory_snapshot)
+     */
+    uint32_t snapshot, last_snapshot;
+    uint32_t *saved_pages;
+    size_t saved_count, saved_capacity;
+};
+
+// Projection d'un fichier dont des pages sont partagées avec la mémoire simulée
+struct memory_mapping {
+    uint8_t *start;
+    size_t length;
+    struct memory_mapping *next;
+};
+
+// Périphérique projeté sur des pages de la mémoire simulée
+struct memory_device {
+    uint32_t base;
+    uint32_t size;
+    const struct memory_device_ops *ops;
+    void *data;
+    struct memory_device *next;
 };
 
-memory memory_create(size_t size, int is_big_endian) {
+// Contenu des pages jamais écrites
+static const uint8_t memory_zero_page[MEMORY_PAGE_SIZE];
+
+// Réserve la projection de MEMORY_HUGE ou MEMORY_HUGETLB, 0 en cas de succès
+static int memory_create_arena(memory mem, size_t size, int backing) {
+    int flags=MAP_PRIVATE | MAP_ANONYMOUS;
+    void *arena;
+
+    if(backing == MEMORY_HUGETLB){
+#ifdef MAP_HUGETLB
+        /* Pas de MAP_NORESERVE : sans assez de pages énormes réservées,
+         * l'échec a lieu ici plutôt qu'en SIGBUS à la première écriture.
+         */
+        size=(size + MEMORY_HUGE_PAGE_SIZE - 1) & ~(MEMORY_HUGE_PAGE_SIZE - 1);
+        flags|=MAP_HUGETLB;
+#else
+        return -1;
+#endif
+    }
+    else{
+        flags|=MAP_NORESERVE;
+    }
+    arena=mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if(arena == MAP_FAILED){
+        return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    if(backing == MEMORY_HUGE)
+        madvise(arena, size, MADV_HUGEPAGE);
+#endif
+    mem->arena=arena;
+    mem->arena_length=size;
+    return 0;
+}
+
+memory memory_create(size_t size, int big_endian) {
+    return memory_create_backed(size, big_endian, MEMORY_HEAP);
+}
+
+memory memory_create_backed(size_t size, int big_endian, int backing) {
     memory mem=malloc(sizeof(struct memory_data));
-    
+    size_t pages=(size + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+    int i;
+
+    if(mem == NULL){
+        return NULL;
+    }
     mem->size=size;
-    mem->is_big_endian=is_big_endian;
-    mem->values=malloc(sizeof(uint8_t)*size);
-    
+    mem->is_big_endian=big_endian;
+    mem->backing=backing;
+    mem->arena=NULL;
+    mem->arena_length=0;
+    mem->allocated_pages=0;
+    mem->tlb_fills=0;
+    if(backing != MEMORY_HEAP && memory_create_arena(mem, size, backing)){
+        free(mem);
+        return NULL;
+    }
+    mem->tlb.swap_mask=(big_endian != is_big_endian()) ? ~0 : 0;
+    for(i=0; i<MEMORY_TLB_SIZE; i++){
+        mem->tlb.read[i].tag=MEMORY_TLB_INVALID;
+        mem->tlb.read[i].addend=0;
+        mem->tlb.write[i].tag=MEMORY_TLB_INVALID;
+        mem->tlb.write[i].addend=0;
+    }
+    mem->pages=calloc(pages, sizeof(struct memory_page));
+    mem->dirty=calloc((pages + 63) / 64, sizeof(uint64_t));
+    mem->watch_handler=NULL;
+    mem->watch_data=NULL;
+    mem->mappings=NULL;
+    mem->devices=NULL;
+    mem->device_accesses=0;
+    mem->snapshot=0;
+    mem->last_snapshot=0;
+    mem->saved_pages=NULL;
+    mem->saved_count=0;
+    mem->saved_capacity=0;
+    if(mem->pages == NULL || mem->dirty == NULL){
+        free(mem->pages);
+        free(mem->dirty);
+        if(mem->arena)
+            munmap(mem->arena, mem->arena_length);
+        free(mem);
+        return NULL;
+    }
     return mem;
 }
 
@@ -44,87 +181,813 @@ size_t memory_get_size(memory mem) {
     return mem->size;
 }
 
+int memory_is_big_endian(memory mem) {
+    return mem->is_big_endian;
+}
+
+void memory_print_stats(memory mem, FILE *out) {
+    static const char *backings[] = { "heap", "transparent huge pages",
+                                      "explicit huge pages" };
+
+    fprintf(out, "Memory: %zu KiB, %s, %zu pages allocated, "
+            "%llu TLB fills\n", mem->size >> 10, backings[mem->backing],
+            mem->allocated_pages, (unsigned long long) mem->tlb_fills);
+}
+
+memory_tlb memory_get_tlb(memory mem) {
+    return &mem->tlb;
+}
+
+/* Les entrées du TLB sont remplies lors des accès qui ne les trouvent pas, si
+ * toute la page est dans la mémoire, et retirées quand le descripteur de leur
+ * page change.
+ */
+static inline void memory_tlb_fill(memory mem, struct memory_tlb_entry *entries,
+                                   uint32_t address, const uint8_t *page) {
+    struct memory_tlb_entry *entry = &entries[MEMORY_TLB_INDEX(address)];
+    uint32_t base = address & MEMORY_PAGE_MASK;
+
+    mem->tlb_fills++;
+    if((uint64_t) base + MEMORY_PAGE_SIZE <= mem->size){
+        entry->tag = base;
+        entry->addend = (uintptr_t) page - base;
+    }
+}
+
+static inline void memory_tlb_drop(struct memory_tlb_entry *entries,
+                                   uint32_t address) {
+    struct memory_tlb_entry *entry = &entries[MEMORY_TLB_INDEX(address)];
+
+    if(entry->tag == (address & MEMORY_PAGE_MASK))
+        entry->tag = MEMORY_TLB_INVALID;
+}
+
+/* Vrai si la page a été allouée par memory_allocate_page hors de la
+ * projection anonyme, faux si elle appartient à l'une des projections et ne
+ * doit pas être libérée
+ */
+static int memory_page_is_allocated(memory mem, uint8_t *page) {
+    struct memory_mapping *mapping;
+
+    if(page >= mem->arena && page < mem->arena + mem->arena_length)
+        return 0;
+    for(mapping=mem->mappings; mapping; mapping=mapping->next)
+        if(page >= mapping->start && page < mapping->start + mapping->length)
+            return 0;
+    return 1;
+}
+
+static void memory_forget_snapshot(memory mem);
+
 void memory_destroy(memory mem) {
-    free(mem->values);
+    size_t i, pages=(mem->size + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+    struct memory_mapping *mapping;
+    struct memory_device *device;
+
+    for(i=0; i<pages; i++)
+        if(mem->pages[i].host &&
+           memory_page_is_allocated(mem, mem->pages[i].host))
+            free(mem->pages[i].host);
+    while(mem->mappings){
+        mapping=mem->mappings;
+        mem->mappings=mapping->next;
+        munmap(mapping->start, mapping->length);
+        free(mapping);
+    }
+    while(mem->devices){
+        device=mem->devices;
+        mem->devices=device->next;
+        if(device->ops->destroy)
+            device->ops->destroy(device->data);
+        free(device);
+    }
+    if(mem->arena)
+        munmap(mem->arena, mem->arena_length);
+    memory_forget_snapshot(mem);
+    free(mem->saved_pages);
+    free(mem->pages);
+    free(mem->dirty);
     free(mem);
 }
 
+void memory_set_watch_handler(memory mem, memory_watch_handler handler,
+                              void *data) {
+    mem->watch_handler=handler;
+    mem->watch_data=data;
+}
+
+void memory_watch_page(memory mem, uint32_t address) {
+    if(address < mem->size){
+        mem->pages[address >> MEMORY_PAGE_SHIFT].watched = 1;
+        memory_tlb_drop(mem->tlb.write, address);
+    }
+}
+
+// Appelée avant chaque écriture de size octets à l'adresse address (déjà validée)
+static inline void memory_check_watch(memory mem, uint32_t address, int size) {
+    uint32_t first = address >> MEMORY_PAGE_SHIFT;
+    uint32_t last = (address + size - 1) >> MEMORY_PAGE_SHIFT;
+
+    if(mem->pages[first].watched | mem->pages[last].watched){
+        mem->pages[first].watched = 0;
+        mem->pages[last].watched = 0;
+        if(mem->watch_handler){
+            mem->watch_handler(mem->watch_data, address);
+            if(last != first)
+                mem->watch_handler(mem->watch_data, address + size - 1);
+        }
+    }
+}
+
+/* Pages de la mémoire simulée : une page jamais écrite se lit comme des zéros
+ * sans être allouée, elle est allouée et mise à zéro lors de sa première
+ * écriture. memory_page_to_write retourne NULL si l'allocation échoue.
+ */
+static inline const uint8_t *memory_page_to_read(memory mem, uint32_t address) {
+    const uint8_t *page = mem->pages[address >> MEMORY_PAGE_SHIFT].host;
+
+    return page ? page : memory_zero_page;
+}
+
+static uint8_t *memory_allocate_page(memory mem, uint32_t address) {
+    uint8_t *page;
+
+    // La place de la page dans la projection anonyme est encore à zéro
+    if(mem->arena)
+        page = mem->arena + ((size_t) (address >> MEMORY_PAGE_SHIFT)
+                             << MEMORY_PAGE_SHIFT);
+    else
+        page = calloc(MEMORY_PAGE_SIZE, sizeof(uint8_t));
+    if(page)
+        mem->allocated_pages++;
+    mem->pages[address >> MEMORY_PAGE_SHIFT].host = page;
+    // Le TLB pouvait donner la page de zéros pour les lectures
+    memory_tlb_drop(mem->tlb.read, address);
+    return page;
+}
+
+static inline void memory_set_dirty(memory mem, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_SHIFT;
+
+    mem->dirty[page / 64] |= (uint64_t) 1 << (page % 64);
+}
+
+/* Lors de la première écriture d'une page depuis la capture ou sa dernière
+ * restauration, conserve son contenu si ce n'est pas déjà fait. Les pages non
+ * allouées sont conservées comme la page de zéros.
+ */
+static int memory_save_page(memory mem, uint32_t address) {
+    struct memory_page *page = &mem->pages[address >> MEMORY_PAGE_SHIFT];
+    uint32_t *saved_pages;
+    uint8_t *copy;
+
+    if(page->saved == NULL){
+        if(mem->saved_count == mem->saved_capacity){
+            saved_pages=realloc(mem->saved_pages, (2 * mem->saved_capacity + 64)
+                                                  * sizeof(uint32_t));
+            if(saved_pages == NULL){
+                return -1;
+            }
+            mem->saved_pages=saved_pages;
+            mem->saved_capacity=2 * mem->saved_capacity + 64;
+        }
+        if(page->host){
+            copy=malloc(MEMORY_PAGE_SIZE);
+            if(copy == NULL){
+                return -1;
+            }
+            memcpy(copy, page->host, MEMORY_PAGE_SIZE);
+            page->saved=copy;
+        }
+        else{
+            page->saved=memory_zero_page;
+        }
+        mem->saved_pages[mem->saved_count++]=address >> MEMORY_PAGE_SHIFT;
+    }
+    page->modified=1;
+    return 0;
+}
+
+static inline uint8_t *memory_page_to_write(memory mem, uint32_t address) {
+    uint8_t *page = mem->pages[address >> MEMORY_PAGE_SHIFT].host;
+
+    memory_set_dirty(mem, address);
+    if(mem->snapshot && !mem->pages[address >> MEMORY_PAGE_SHIFT].modified &&
+       memory_save_page(mem, address)){
+        return NULL;
+    }
+    return page ? page : memory_allocate_page(mem, address);
+}
+
+/* Copies entre la mémoire simulée et un tampon de l'hôte, pour size octets
+ * dans la mémoire à partir de address. Le cas courant, un accès contenu dans
+ * une page, est traité en ligne, les autres page par page.
+ */
+static void memory_copy_from_pages(memory mem, uint32_t address, void *buffer,
+                                   size_t size) {
+    size_t length;
+
+    while(size){
+        length = min(size, MEMORY_PAGE_SIZE - MEMORY_PAGE_OFFSET(address));
+        memcpy(buffer, memory_page_to_read(mem, address) +
+               MEMORY_PAGE_OFFSET(address), length);
+        buffer = (uint8_t *) buffer + length;
+        address += length;
+        size -= length;
+    }
+}
+
+static int memory_copy_to_pages(memory mem, uint32_t address,
+                                const void *buffer, size_t size) {
+    size_t length;
+    uint8_t *page;
+
+    while(size){
+        length = min(size, MEMORY_PAGE_SIZE - MEMORY_PAGE_OFFSET(address));
+        page = memory_page_to_write(mem, address);
+        if(page == NULL){
+            return -1;
+        }
+        memcpy(page + MEMORY_PAGE_OFFSET(address), buffer, length);
+        buffer = (const uint8_t *) buffer + length;
+        address += length;
+        size -= length;
+    }
+    return 0;
+}
+
+static inline void memory_copy_from(memory mem, uint32_t address, void *buffer,
+                                    size_t size) {
+    const uint8_t *page;
+
+    if(MEMORY_PAGE_OFFSET(address) + size <= MEMORY_PAGE_SIZE){
+        page = memory_page_to_read(mem, address);
+        memcpy(buffer, page + MEMORY_PAGE_OFFSET(address), size);
+        memory_tlb_fill(mem, mem->tlb.read, address, page);
+    }
+    else{
+        memory_copy_from_pages(mem, address, buffer, size);
+    }
+}
+
+static inline int memory_copy_to(memory mem, uint32_t address,
+                                 const void *buffer, size_t size) {
+    uint8_t *page;
+
+    if(MEMORY_PAGE_OFFSET(address) + size <= MEMORY_PAGE_SIZE){
+        page = memory_page_to_write(mem, address);
+        if(page == NULL){
+            return -1;
+        }
+        memcpy(page + MEMORY_PAGE_OFFSET(address), buffer, size);
+        // Le gestionnaire de surveillance a pu surveiller à nouveau la page
+        if(!mem->pages[address >> MEMORY_PAGE_SHIFT].watched)
+            memory_tlb_fill(mem, mem->tlb.write, address, page);
+        return 0;
+    }
+    return memory_copy_to_pages(mem, address, buffer, size);
+}
+
+/* Les octets sont rangés dans l'ordre de la mémoire simulée : un demi-mot ou
+ * un mot est lu ou écrit par un seul accès de l'hôte, puis ses octets sont
+ * inversés si l'hôte n'a pas le même boutisme. Le masque choisit entre la
+ * valeur et son inverse sans tester le boutisme à chaque accès.
+ */
+static inline uint16_t memory_order_half(memory mem, uint16_t value) {
+    return value ^ ((value ^ reverse_2(value)) & mem->tlb.swap_mask);
+}
+
+static inline uint32_t memory_order_word(memory mem, uint32_t value) {
+    return value ^ ((value ^ reverse_4(value)) & mem->tlb.swap_mask);
+}
+
+// Vrai si les size octets à partir de address sont dans la mémoire
+static inline int memory_in_range(memory mem, uint32_t address, uint64_t size) {
+    return (uint64_t) address + size <= mem->size;
+}
+
+/* Périphérique visé par un accès de size octets, NULL si l'accès ne touche que
+ * de la RAM. Un accès à cheval sur deux pages, dont l'une appartient à un
+ * périphérique, est donné à ce dernier qui le refusera.
+ */
+static inline struct memory_device *memory_device_at(memory mem,
+                                                     uint32_t address,
+                                                     int size) {
+    struct memory_device *device;
+
+    device=mem->pages[address >> MEMORY_PAGE_SHIFT].device;
+    if(device == NULL)
+        device=mem->pages[(address + size - 1) >> MEMORY_PAGE_SHIFT].device;
+    return device;
+}
+
+// Vrai si l'une des pages de [address, address + size[ est un périphérique
+static int memory_has_device(memory mem, uint32_t address, uint64_t size) {
+    uint64_t page;
+
+    if(mem->devices == NULL || size == 0){
+        return 0;
+    }
+    for(page=address >> MEMORY_PAGE_SHIFT;
+        page <= (address + size - 1) >> MEMORY_PAGE_SHIFT; page++)
+        if(mem->pages[page].device)
+            return 1;
+    return 0;
+}
+
+static int memory_device_accepts(struct memory_device *device,
+                                 uint32_t address, int size) {
+    return (device->ops->widths & size) && (address & (size - 1)) == 0 &&
+           address >= device->base &&
+           (uint64_t) address - device->base + size <= device->size;
+}
+
+static int memory_device_read(memory mem, struct memory_device *device,
+                              uint32_t address, int size, uint32_t *value) {
+    mem->device_accesses++;
+    if(!memory_device_accepts(device, address, size) || !device->ops->read){
+        return -1;
+    }
+    return device->ops->read(device->data, address - device->base, size,
+                             value);
+}
+
+static int memory_device_write(memory mem, struct memory_device *device,
+                               uint32_t address, int size, uint32_t value) {
+    mem->device_accesses++;
+    if(!memory_device_accepts(device, address, size) || !device->ops->write){
+        return -1;
+    }
+    return device->ops->write(device->data, address - device->base, size,
+                              value);
+}
+
 int memory_read_byte(memory mem, uint32_t address, uint8_t *value) {
-    if(address < 0 || address >= mem->size){
+    struct memory_device *device;
+    uint32_t word;
+
+    if(!memory_in_range(mem, address, 1)){
         return -1;
     }
-    *value = mem->values[address];
+    if((device = memory_device_at(mem, address, 1))){
+        if(memory_device_read(mem, device, address, 1, &word))
+            return -1;
+        *value = word;
+        return 0;
+    }
+    memory_copy_from(mem, address, value, 1);
     return 0;
 }
 
 int memory_read_half(memory mem, uint32_t address, uint16_t *value) {
-    if(address < 0 || address+1 >= mem->size){
+    struct memory_device *device;
+    uint32_t word;
+    uint16_t half;
+
+    if(!memory_in_range(mem, address, 2)){
         return -1;
     }
-    if(mem->is_big_endian){
-        *value = mem->values[address]<<8;
-        *value = *value | mem->values[address + 1];
-    }
-    else{
-        *value = mem->values[address + 1] << 8;
-        *value = *value | mem->values[address];
+    if((device = memory_device_at(mem, address, 2))){
+        if(memory_device_read(mem, device, address, 2, &word))
+            return -1;
+        *value = word;
+        return 0;
     }
+    memory_copy_from(mem, address, &half, 2);
+    *value = memory_order_half(mem, half);
     return 0;
 }
 
 int memory_read_word(memory mem, uint32_t address, uint32_t *value) {
-    if(address < 0 || address+3 >= mem->size){
+    struct memory_device *device;
+    uint32_t word;
+
+    if(!memory_in_range(mem, address, 4)){
         return -1;
-    }    
-    if(mem->is_big_endian){
-        *value = mem->values[address]<<24 | mem->values[address + 1] << 16 | mem->values[address + 2] << 8 | mem->values[address+3];
     }
-    else
-    {
-        *value = mem->values[address + 3]<<24 | mem->values[address + 2] << 16 | mem->values[address + 1] << 8 | mem->values[address];
+    if((device = memory_device_at(mem, address, 4))){
+        return memory_device_read(mem, device, address, 4, value);
     }
+    memory_copy_from(mem, address, &word, 4);
+    *value = memory_order_word(mem, word);
     return 0;
-    
 }
 
 int memory_write_byte(memory mem, uint32_t address, uint8_t value) {
-    if(address < 0 || address >= mem->size){
+    struct memory_device *device;
+
+    if(!memory_in_range(mem, address, 1)){
         return -1;
     }
-    mem->values[address] = value;
-    return 0;
+    if((device = memory_device_at(mem, address, 1))){
+        return memory_device_write(mem, device, address, 1, value);
+    }
+    memory_check_watch(mem, address, 1);
+    return memory_copy_to(mem, address, &value, 1);
 }
 
 int memory_write_half(memory mem, uint32_t address, uint16_t value) {
-    if(address < 0 || address+1 >= mem->size){
+    struct memory_device *device;
+
+    if(!memory_in_range(mem, address, 2)){
         return -1;
     }
-    if(mem->is_big_endian){
-        mem->values[address] = (uint8_t) (value >> 8);
-        mem->values[address+1] = (uint8_t) value;
+    if((device = memory_device_at(mem, address, 2))){
+        return memory_device_write(mem, device, address, 2, value);
     }
-    else{
-        mem->values[address] = (uint8_t) value;
-        mem->values[address+1] = (uint8_t) (value >> 8);
+    memory_check_watch(mem, address, 2);
+    value = memory_order_half(mem, value);
+    return memory_copy_to(mem, address, &value, 2);
+}
+
+int memory_write_word(memory mem, uint32_t address, uint32_t value) {
+    struct memory_device *device;
+
+    if(!memory_in_range(mem, address, 4)){
+        return -1;
+    }
+    if((device = memory_device_at(mem, address, 4))){
+        return memory_device_write(mem, device, address, 4, value);
+    }
+    memory_check_watch(mem, address, 4);
+    value = memory_order_word(mem, value);
+    return memory_copy_to(mem, address, &value, 4);
+}
+
+int memory_read_words(memory mem, uint32_t address, uint32_t *values,
+                      int count) {
+    int i;
+
+    if(!memory_in_range(mem, address, 4 * (uint64_t) count)){
+        return -1;
+    }
+    if(memory_has_device(mem, address, 4 * (uint64_t) count)){
+        for(i=0; i<count; i++)
+            if(memory_read_word(mem, address + 4*i, &values[i]))
+                return -1;
+        return 0;
+    }
+    memory_copy_from(mem, address, values, 4 * count);
+    if(mem->tlb.swap_mask){
+        for(i=0; i<count; i++)
+            values[i] = reverse_4(values[i]);
     }
     return 0;
 }
 
-int memory_write_word(memory mem, uint32_t address, uint32_t value) {
-    if(address < 0 || address+3 >= mem->size){
+int memory_write_words(memory mem, uint32_t address, uint32_t *values,
+                       int count) {
+    uint32_t value;
+    int i;
+
+    if(!memory_in_range(mem, address, 4 * (uint64_t) count)){
         return -1;
     }
-    if(mem->is_big_endian){
-        mem->values[address] = (uint8_t) (value >> 24);
-        mem->values[address+1] = (uint8_t) (value >> 16);
-        mem->values[address+2] = (uint8_t) (value >> 8);
-        mem->values[address+3] = (uint8_t) value;
+    if(count == 0){
+        return 0;
     }
-    else{
-        mem->values[address+3] = (uint8_t) (value >> 24);
-        mem->values[address+2] = (uint8_t) (value >> 16);
-        mem->values[address+1] = (uint8_t) (value >> 8);
-        mem->values[address] = (uint8_t) value;
+    if(memory_has_device(mem, address, 4 * (uint64_t) count)){
+        for(i=0; i<count; i++)
+            if(memory_write_word(mem, address + 4*i, values[i]))
+                return -1;
+        return 0;
+    }
+    // Chaque page touchée par le bloc contient l'un de ces mots
+    for(i=0; i<count; i+=MEMORY_PAGE_SIZE / 4)
+        memory_check_watch(mem, address + 4*i, 4);
+    memory_check_watch(mem, address + 4*(count-1), 4);
+    if(mem->tlb.swap_mask){
+        for(i=0; i<count; i++){
+            value = reverse_4(values[i]);
+            if(memory_copy_to(mem, address + 4*i, &value, 4))
+                return -1;
+        }
+        return 0;
+    }
+    return memory_copy_to(mem, address, values, 4 * count);
+}
+
+// Appelée avant l'écriture de size octets à l'adresse address, page par page
+static void memory_check_watch_block(memory mem, uint32_t address,
+                                     size_t size) {
+    size_t done, chunk;
+
+    for(done=0; done<size; done+=chunk){
+        chunk = min(size - done,
+                    MEMORY_PAGE_SIZE - MEMORY_PAGE_OFFSET(address + done));
+        memory_check_watch(mem, address + done, chunk);
+    }
+}
+
+int memory_read_block(memory mem, uint32_t address, void *buffer,
+                      size_t size) {
+    size_t i;
+
+    if(!memory_in_range(mem, address, size)){
+        return -1;
+    }
+    if(size == 0){ // Sonde de gdb (X addr,0:), rien à allouer ni à salir
+        return 0;
+    }
+    if(memory_has_device(mem, address, size)){
+        for(i=0; i<size; i++)
+            if(memory_read_byte(mem, address + i, (uint8_t *) buffer + i))
+                return -1;
+        return 0;
+    }
+    memory_copy_from(mem, address, buffer, size);
+    return 0;
+}
+
+int memory_write_block(memory mem, uint32_t address, const void *buffer,
+                       size_t size) {
+    size_t i;
+
+    if(!memory_in_range(mem, address, size)){
+        return -1;
+    }
+    if(size == 0){ // Sonde de gdb (X addr,0:), rien à allouer ni à salir
+        return 0;
+    }
+    if(memory_has_device(mem, address, size)){
+        for(i=0; i<size; i++)
+            if(memory_write_byte(mem, address + i,
+                                 ((const uint8_t *) buffer)[i]))
+                return -1;
+        return 0;
+    }
+    memory_check_watch_block(mem, address, size);
+    return memory_copy_to(mem, address, buffer, size);
+}
+
+/* Les pages suivantes ne prolongent une tranche que si elles la suivent aussi
+ * chez l'hôte : pour l'écriture, seules les pages de la projection anonyme
+ * sont prises avant d'être allouées, leur place y étant connue d'avance.
+ */
+static size_t memory_span_length(memory mem, uint32_t address, size_t size,
+                                 const uint8_t *span, int write) {
+    size_t length = min(size, MEMORY_PAGE_SIZE - MEMORY_PAGE_OFFSET(address));
+    uint64_t next = (uint64_t) address + length;
+    struct memory_page *page;
+    const uint8_t *host;
+
+    size = min(size, mem->size - address);
+    while(length < size && (next & (MEMORY_PAGE_SIZE - 1)) == 0){
+        page = &mem->pages[next >> MEMORY_PAGE_SHIFT];
+        host = page->host;
+        if(host == NULL && write && mem->arena)
+            host = mem->arena + next;
+        if(page->device || host != span + length)
+            break;
+        length += min(size - length, MEMORY_PAGE_SIZE);
+        next += MEMORY_PAGE_SIZE;
+    }
+    return length;
+}
+
+const uint8_t *memory_read_span(memory mem, uint32_t address, size_t size,
+                                size_t *length) {
+    const uint8_t *span;
+
+    if(!memory_in_range(mem, address, 1) || memory_device_at(mem, address, 1)){
+        return NULL;
+    }
+    span = memory_page_to_read(mem, address) + MEMORY_PAGE_OFFSET(address);
+    *length = memory_span_length(mem, address, size, span, 0);
+    return span;
+}
+
+uint8_t *memory_write_span(memory mem, uint32_t address, size_t size,
+                           size_t *length) {
+    size_t result, done;
+    uint8_t *span;
+
+    if(!memory_in_range(mem, address, 1) || memory_device_at(mem, address, 1)){
+        return NULL;
+    }
+    memory_check_watch(mem, address, 1);
+    span = memory_page_to_write(mem, address);
+    if(span == NULL){
+        return NULL;
+    }
+    span += MEMORY_PAGE_OFFSET(address);
+    result = memory_span_length(mem, address, size, span, 1);
+    // Les pages suivantes de la tranche sont écrites dès maintenant
+    for(done = MEMORY_PAGE_SIZE - MEMORY_PAGE_OFFSET(address); done < result;
+        done += MEMORY_PAGE_SIZE){
+        memory_check_watch(mem, address + done, 1);
+        if(memory_page_to_write(mem, address + done) == NULL){
+            return NULL;
+        }
+    }
+    *length = result;
+    return span;
+}
+
+int memory_map_file(memory mem, uint32_t address, int fd, off_t offset,
+                    size_t length) {
+    struct memory_mapping *mapping;
+    struct stat status;
+    size_t shift, done, chunk;
+    uint8_t *start, *host, **page;
+    int shared=0;
+
+    if(!memory_in_range(mem, address, length) ||
+       memory_has_device(mem, address, length) || fstat(fd, &status) ||
+       offset < 0 || (uint64_t) offset + length > (uint64_t) status.st_size){
+        return -1;
+    }
+    if(length == 0){
+        return 0;
+    }
+    // mmap projette le fichier à partir d'un début de page de l'hôte
+    shift = offset % sysconf(_SC_PAGESIZE);
+    start = mmap(NULL, length + shift, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                 offset - shift);
+    mapping = malloc(sizeof(struct memory_mapping));
+    if(start == MAP_FAILED || mapping == NULL){
+        if(start != MAP_FAILED)
+            munmap(start, length + shift);
+        free(mapping);
+        return -1;
+    }
+    mapping->start=start;
+    mapping->length=length + shift;
+    mapping->next=mem->mappings;
+    mem->mappings=mapping;
+    host = start + shift;
+    for(done=0; done<length; done+=chunk){
+        chunk = min(length - done,
+                    MEMORY_PAGE_SIZE - MEMORY_PAGE_OFFSET(address + done));
+        memory_check_watch(mem, address + done, chunk);
+        page = &mem->pages[(address + done) >> MEMORY_PAGE_SHIFT].host;
+        if(chunk == MEMORY_PAGE_SIZE &&
+           MEMORY_PAGE_OFFSET((uintptr_t) (host + done)) == 0){
+            if(mem->snapshot && memory_save_page(mem, address + done))
+                break;
+            // Page entière alignée dans le fichier : elle est partagée
+            if(*page && memory_page_is_allocated(mem, *page))
+                free(*page);
+            *page = host + done;
+            memory_set_dirty(mem, address + done);
+            memory_tlb_drop(mem->tlb.read, address + done);
+            memory_tlb_drop(mem->tlb.write, address + done);
+            shared = 1;
+        }
+        else if(memory_copy_to(mem, address + done, host + done, chunk)){
+            break;
+        }
+    }
+    // Sans page partagée, la projection n'a servi qu'à la copie
+    if(!shared){
+        mem->mappings=mapping->next;
+        munmap(start, length + shift);
+        free(mapping);
+    }
+    return done < length ? -1 : 0;
+}
+
+int memory_add_device(memory mem, uint32_t base, uint32_t size,
+                      const struct memory_device_ops *ops, void *data) {
+    struct memory_device *device;
+    uint64_t address;
+
+    if(size == 0 || MEMORY_PAGE_OFFSET(base) || MEMORY_PAGE_OFFSET(size) ||
+       !memory_in_range(mem, base, size) || memory_has_device(mem, base, size)){
+        return -1;
+    }
+    device=malloc(sizeof(struct memory_device));
+    if(device == NULL){
+        return -1;
+    }
+    device->base=base;
+    device->size=size;
+    device->ops=ops;
+    device->data=data;
+    device->next=mem->devices;
+    mem->devices=device;
+    for(address=base; address<(uint64_t) base + size;
+        address+=MEMORY_PAGE_SIZE){
+        mem->pages[address >> MEMORY_PAGE_SHIFT].device=device;
+        // Les accès à la page ne doivent plus passer par le TLB
+        memory_tlb_drop(mem->tlb.read, address);
+        memory_tlb_drop(mem->tlb.write, address);
+    }
+    return 0;
+}
+
+uint32_t memory_get_device_accesses(memory mem) {
+    return mem->device_accesses;
+}
+
+int memory_is_dirty(memory mem, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_SHIFT;
+
+    if(address >= mem->size){
+        return 0;
+    }
+    return (mem->dirty[page / 64] >> (page % 64)) & 1;
+}
+
+/* Parcourt les pages sales de [address, address + size[ par mots de 64 bits
+ * de la table, en sautant les mots nuls : le coût dépend du nombre de pages
+ * sales plus que de la taille de la mémoire. Avec clear, les pages sont
+ * nettoyées au passage.
+ */
+static size_t memory_scan_dirty(memory mem, uint32_t address, size_t size,
+                                int clear, memory_dirty_handler handler,
+                                void *data) {
+    uint64_t first, last, page, bits;
+    size_t count=0;
+    int bit;
+
+    if(size == 0 || address >= mem->size){
+        return 0;
+    }
+    size=min(size, mem->size - address);
+    first=address >> MEMORY_PAGE_SHIFT;
+    last=((uint64_t) address + size - 1) >> MEMORY_PAGE_SHIFT;
+    for(page=first & ~(uint64_t) 63; page<=last; page+=64){
+        bits=mem->dirty[page / 64];
+        // Bits des pages hors de l'intervalle dans le premier et le dernier mot
+        if(page < first)
+            bits&=~(uint64_t) 0 << (first - page);
+        if(last - page < 63)
+            bits&=~(~(uint64_t) 0 << (last - page + 1));
+        if(clear)
+            mem->dirty[page / 64]&=~bits;
+        while(bits){
+            bit=__builtin_ctzll(bits);
+            bits&=bits - 1;
+            address=(page + bit) << MEMORY_PAGE_SHIFT;
+            if(clear) // Les écritures par le TLB ne marqueraient pas la page
+                memory_tlb_drop(mem->tlb.write, address);
+            if(handler)
+                handler(data, address);
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t memory_for_each_dirty(memory mem, uint32_t address, size_t size,
+                             memory_dirty_handler handler, void *data) {
+    return memory_scan_dirty(mem, address, size, 0, handler, data);
+}
+
+size_t memory_clear_dirty(memory mem, uint32_t address, size_t size) {
+    return memory_scan_dirty(mem, address, size, 1, NULL, NULL);
+}
+
+// Les pages non modifiées depuis la capture ne doivent pas être dans le TLB
+static void memory_tlb_drop_writes(memory mem) {
+    int i;
+
+    for(i=0; i<MEMORY_TLB_SIZE; i++)
+        mem->tlb.write[i].tag=MEMORY_TLB_INVALID;
+}
+
+// Libère les contenus conservés par la capture en cours
+static void memory_forget_snapshot(memory mem) {
+    struct memory_page *page;
+    size_t i;
+
+    for(i=0; i<mem->saved_count; i++){
+        page=&mem->pages[mem->saved_pages[i]];
+        if(page->saved != memory_zero_page)
+            free((uint8_t *) page->saved);
+        page->saved=NULL;
+        page->modified=0;
+    }
+    mem->saved_count=0;
+    mem->snapshot=0;
+}
+
+uint32_t memory_snapshot(memory mem) {
+    memory_forget_snapshot(mem);
+    memory_tlb_drop_writes(mem);
+    mem->snapshot=++mem->last_snapshot;
+    return mem->snapshot;
+}
+
+int memory_restore(memory mem, uint32_t snapshot) {
+    struct memory_page *page;
+    uint32_t address;
+    size_t i;
+
+    if(snapshot == 0 || snapshot != mem->snapshot){
+        return -1;
+    }
+    for(i=0; i<mem->saved_count; i++){
+        page=&mem->pages[mem->saved_pages[i]];
+        if(!page->modified || page->host == NULL)
+            continue;
+        address=mem->saved_pages[i] << MEMORY_PAGE_SHIFT;
+        memory_check_watch(mem, address, MEMORY_PAGE_SIZE);
+        memcpy(page->host, page->saved, MEMORY_PAGE_SIZE);
+        memory_set_dirty(mem, address);
+        page->modified=0;
     }
+    memory_tlb_drop_writes(mem);
     return 0;
 }
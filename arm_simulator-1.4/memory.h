@@ -23,14 +23,46 @@ Contact: Guillaume.Huard@imag.fr
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
+#include "util.h"
 
 typedef struct memory_data *memory;
 
+/* The memory covers addresses 0 to size - 1, at most the whole 32 bits
+ * address space (MEMORY_FULL_SIZE). It is sparse: it reads as zeros and
+ * each page only gets allocated when first written.
+ */
+#define MEMORY_FULL_SIZE ((size_t) 1 << 32)
+
 memory memory_create(size_t size, int is_big_endian);
 size_t memory_get_size(memory mem);
+int memory_is_big_endian(memory mem);
 void memory_destroy(memory mem);
 
+/* Where the host memory of pages comes from. memory_create uses MEMORY_HEAP,
+ * that allocates each page on its own when first written. The others reserve
+ * the size bytes of address space at once in an anonymous mapping, into which
+ * the host only brings pages when they are first written: MEMORY_HUGE asks
+ * for transparent huge pages with madvise, MEMORY_HUGETLB maps explicit huge
+ * pages (MAP_HUGETLB) and fails unless enough of them have been reserved on
+ * the host for the whole size. Huge pages spare host TLB misses to guests
+ * spreading their accesses over many megabytes.
+ * memory_create_backed returns NULL if the mapping cannot be made.
+ */
+#define MEMORY_HEAP 0
+#define MEMORY_HUGE 1
+#define MEMORY_HUGETLB 2
+#define MEMORY_HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+memory memory_create_backed(size_t size, int is_big_endian, int backing);
+
+/* Outputs the size and backing of mem, how many pages have been allocated and
+ * how many accesses missed the software TLB (see memory_get_tlb).
+ */
+void memory_print_stats(memory mem, FILE *out);
+
 /* All these functions perform a read/write access to a byte/half/word data at
  * address a in mem. The result is respectively taken from or stored to the
  * parameter value. The access is made using the given endianess (be == 1 for a
@@ -44,4 +76,230 @@ int memory_write_byte(memory mem, uint32_t address, uint8_t value);
 int memory_write_half(memory mem, uint32_t address, uint16_t value);
 int memory_write_word(memory mem, uint32_t address, uint32_t value);
 
+/* Transfer count consecutive words starting at address from or to values, as
+ * count calls to memory_read_word or memory_write_word would, but the range
+ * is checked once and copied at once. On failure, nothing is transferred,
+ * except for blocks touching a device (see below), that are transferred one
+ * word at a time up to the failing one.
+ */
+int memory_read_words(memory mem, uint32_t address, uint32_t *values,
+                      int count);
+int memory_write_words(memory mem, uint32_t address, uint32_t *values,
+                       int count);
+
+/* Transfer size bytes starting at address from or to buffer, in the order of
+ * the simulated memory, as size calls to memory_read_byte or memory_write_byte
+ * would, but the range is checked once and copied at once. On failure,
+ * nothing is transferred, except for blocks touching a device, that are
+ * transferred one byte at a time up to the failing one.
+ */
+int memory_read_block(memory mem, uint32_t address, void *buffer,
+                      size_t size);
+int memory_write_block(memory mem, uint32_t address, const void *buffer,
+                       size_t size);
+
+/* Borrow the host memory holding the bytes at address, in the order of the
+ * simulated memory, to read or write them in place. *length is set to how
+ * many of the size bytes following address are contiguous at the returned
+ * pointer: at least up to the end of the page (or size if lower), more when
+ * the following pages happen to be contiguous on the host too, as within the
+ * mapping of a memory created by memory_create_backed. Returns NULL, with
+ * *length left unchanged, for addresses out of the memory or in a device
+ * page, that callers have to access through the functions above.
+ * A read span of a page never written points to zeros shared by all such
+ * pages, it does not see later writes. A write span makes its pages written
+ * from the moment it is borrowed: the watch handler is called, they become
+ * dirty and get saved for the current snapshot. Spans remain valid until
+ * memory_map_file or memory_destroy is called.
+ */
+const uint8_t *memory_read_span(memory mem, uint32_t address, size_t size,
+                                size_t *length);
+uint8_t *memory_write_span(memory mem, uint32_t address, size_t size,
+                           size_t *length);
+
+/* Loads length bytes of the file fd, starting at offset, at address. The
+ * pages entirely filled from the file are not copied but mapped from it
+ * copy-on-write (MAP_PRIVATE), so that they are shared with other processes
+ * until written. This requires address and offset to have the same offset
+ * within a page. Returns 0 on success and -1 on failure, which includes
+ * ranges covering a device.
+ */
+int memory_map_file(memory mem, uint32_t address, int fd, off_t offset,
+                    size_t length);
+
+/* Memory is split in pages of (1 << MEMORY_PAGE_SHIFT) bytes that can be
+ * watched. The first write into a watched page unwatches it and calls the
+ * handler given to memory_set_watch_handler with the written address. This is
+ * how the core learns that instructions it has already decoded are modified.
+ */
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_MASK (~(uint32_t) (MEMORY_PAGE_SIZE - 1))
+
+typedef void (*memory_watch_handler)(void *data, uint32_t address);
+
+void memory_set_watch_handler(memory mem, memory_watch_handler handler,
+                              void *data);
+void memory_watch_page(memory mem, uint32_t address);
+
+/* Dirty page tracking: every write into a page of RAM, including those made
+ * by the TLB accessors and by memory_map_file, marks the page dirty. This
+ * costs nothing on TLB hits, as clearing a page also drops it from the TLB.
+ * memory_for_each_dirty calls handler, in increasing order, with the address
+ * of each dirty page among the pages of [address, address + size[, and
+ * memory_clear_dirty clears these pages. Both return the number of dirty
+ * pages found, skipping clean ranges 64 pages at a time.
+ */
+typedef void (*memory_dirty_handler)(void *data, uint32_t address);
+
+int memory_is_dirty(memory mem, uint32_t address);
+size_t memory_for_each_dirty(memory mem, uint32_t address, size_t size,
+                             memory_dirty_handler handler, void *data);
+size_t memory_clear_dirty(memory mem, uint32_t address, size_t size);
+
+/* Snapshot of the contents of the memory, taken copy-on-write: memory_snapshot
+ * costs nothing but dropping the previous snapshot, and the first write into
+ * each page after the snapshot saves a copy of it. memory_restore copies back
+ * the pages written since the snapshot or the previous restore, so that the
+ * same snapshot can be restored many times at the cost of the pages modified
+ * in between. There is a single snapshot at a time, identified by the value
+ * returned by memory_snapshot: memory_restore returns -1 when given an older
+ * one, 0 otherwise. Devices are not part of the snapshot.
+ */
+uint32_t memory_snapshot(memory mem);
+int memory_restore(memory mem, uint32_t snapshot);
+
+/* Memory mapped devices: a device covers whole pages, from base to
+ * base + size - 1 (both multiples of MEMORY_PAGE_SIZE), and the accesses
+ * made there by the memory_read_* and memory_write_* functions are given to
+ * its handlers instead of RAM. Handlers get the offset of the access from
+ * base, its size in bytes and the value as seen by the processor, with no
+ * endianess conversion. Accesses of a size not in the widths mask, unaligned
+ * or missing a handler fail without reaching the device, as do the accesses
+ * for which a handler returns -1. Device pages are never entered in the TLB,
+ * so that RAM accesses do not pay for the dispatch.
+ */
+#define MEMORY_DEVICE_BYTE 1
+#define MEMORY_DEVICE_HALF 2
+#define MEMORY_DEVICE_WORD 4
+
+struct memory_device_ops {
+    int (*read)(void *data, uint32_t offset, int size, uint32_t *value);
+    int (*write)(void *data, uint32_t offset, int size, uint32_t value);
+    void (*destroy)(void *data); /* called by memory_destroy, may be NULL */
+    int widths;
+};
+
+/* Returns 0 on success, -1 if the region is not made of whole pages of the
+ * memory or overlaps another device.
+ */
+int memory_add_device(memory mem, uint32_t base, uint32_t size,
+                      const struct memory_device_ops *ops, void *data);
+/* Number of accesses made to devices so far, successful or not */
+uint32_t memory_get_device_accesses(memory mem);
+
+/* Software TLB: a small direct mapped cache of the page descriptors, in front
+ * of the accesses made by the processor. An entry gives, for a page of RAM
+ * that can be accessed directly, the difference between host and guest
+ * addresses: a hit costs a masked compare and one load. The mask keeps the
+ * low bits of the address, so that unaligned accesses, which may cross a page
+ * boundary, always miss. Reads and writes have their own entries, a page
+ * being writable through the TLB only once allocated and while not watched.
+ * Entries are filled by the memory_read_* and memory_write_* functions, that
+ * the accessors below call on a miss, and dropped when their page changes.
+ */
+#define MEMORY_TLB_SIZE 256
+/* No masked address has low bits beyond the two kept for word accesses */
+#define MEMORY_TLB_INVALID (MEMORY_PAGE_SIZE - 1)
+
+struct memory_tlb_entry {
+    uint32_t tag;     /* guest address of the page, or MEMORY_TLB_INVALID */
+    uintptr_t addend; /* host address - guest address */
+};
+
+typedef struct memory_tlb {
+    struct memory_tlb_entry read[MEMORY_TLB_SIZE];
+    struct memory_tlb_entry write[MEMORY_TLB_SIZE];
+    uint32_t swap_mask; /* ~0 if the host has another endianess, 0 otherwise */
+} *memory_tlb;
+
+memory_tlb memory_get_tlb(memory mem);
+
+/* Host address of the size bytes at address if they are in the TLB */
+static inline uint8_t *memory_tlb_lookup(struct memory_tlb_entry *entries,
+                                         uint32_t address, uint32_t size) {
+    struct memory_tlb_entry *entry =
+        &entries[(address >> MEMORY_PAGE_SHIFT) & (MEMORY_TLB_SIZE - 1)];
+
+    if ((address & (MEMORY_PAGE_MASK | (size - 1))) == entry->tag)
+        return (uint8_t *) (entry->addend + address);
+    return NULL;
+}
+
+static inline int memory_tlb_read_byte(memory_tlb tlb, memory mem,
+                                       uint32_t address, uint8_t *value) {
+    uint8_t *host = memory_tlb_lookup(tlb->read, address, 1);
+
+    if (host == NULL)
+        return memory_read_byte(mem, address, value);
+    *value = *host;
+    return 0;
+}
+
+static inline int memory_tlb_read_half(memory_tlb tlb, memory mem,
+                                       uint32_t address, uint16_t *value) {
+    uint8_t *host = memory_tlb_lookup(tlb->read, address, 2);
+    uint16_t half;
+
+    if (host == NULL)
+        return memory_read_half(mem, address, value);
+    memcpy(&half, host, 2);
+    *value = half ^ ((half ^ reverse_2(half)) & tlb->swap_mask);
+    return 0;
+}
+
+static inline int memory_tlb_read_word(memory_tlb tlb, memory mem,
+                                       uint32_t address, uint32_t *value) {
+    uint8_t *host = memory_tlb_lookup(tlb->read, address, 4);
+    uint32_t word;
+
+    if (host == NULL)
+        return memory_read_word(mem, address, value);
+    memcpy(&word, host, 4);
+    *value = word ^ ((word ^ reverse_4(word)) & tlb->swap_mask);
+    return 0;
+}
+
+static inline int memory_tlb_write_byte(memory_tlb tlb, memory mem,
+                                        uint32_t address, uint8_t value) {
+    uint8_t *host = memory_tlb_lookup(tlb->write, address, 1);
+
+    if (host == NULL)
+        return memory_write_byte(mem, address, value);
+    *host = value;
+    return 0;
+}
+
+static inline int memory_tlb_write_half(memory_tlb tlb, memory mem,
+                                        uint32_t address, uint16_t value) {
+    uint8_t *host = memory_tlb_lookup(tlb->write, address, 2);
+
+    if (host == NULL)
+        return memory_write_half(mem, address, value);
+    value ^= (value ^ reverse_2(value)) & tlb->swap_mask;
+    memcpy(host, &value, 2);
+    return 0;
+}
+
+static inline int memory_tlb_write_word(memory_tlb tlb, memory mem,
+                                        uint32_t address, uint32_t value) {
+    uint8_t *host = memory_tlb_lookup(tlb->write, address, 4);
+
+    if (host == NULL)
+        return memory_write_word(mem, address, value);
+    value ^= (value ^ reverse_4(value)) & tlb->swap_mask;
+    memcpy(host, &value, 4);
+    return 0;
+}
+
 #endif
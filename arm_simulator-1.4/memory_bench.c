@@ -0,0 +1,115 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T à but pédagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Générale GNU publiée par la Free Software
+Foundation (version 2 ou bien toute autre version ultérieure choisie par vous).
+
+Ce programme est distribué car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spécifique. Reportez-vous à la
+Licence Publique Générale GNU pour plus de détails.
+
+Vous devez avoir reçu une copie de la Licence Publique Générale GNU en même
+temps que ce programme ; si ce n'est pas le cas, écrivez à la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+États-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Bâtiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hères
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "memory.h"
+#include "util.h"
+
+/* Measures the throughput of the accesses to the simulated memory, for both
+ * endianesses. Usage:
+ *   memory_bench [number of accesses per measure]
+ */
+
+#define DEFAULT_ACCESSES 100000000
+#define MEMORY_SIZE (1 << 20)
+
+enum { READ_BYTE, READ_HALF, READ_WORD, WRITE_BYTE, WRITE_HALF, WRITE_WORD };
+
+static char *access_names[] = {
+    "byte reads", "half reads", "word reads",
+    "byte writes", "half writes", "word writes"
+};
+
+/* Accumulates the values read so that the reads cannot be dropped */
+static volatile uint32_t sink;
+
+static double measure(memory m, int access, long accesses) {
+    struct timespec start, end;
+    uint32_t address = 0, size, mask, word, sum = 0;
+    uint16_t half;
+    uint8_t byte;
+    long i;
+
+    size = (access == READ_BYTE || access == WRITE_BYTE) ? 1 :
+           (access == READ_HALF || access == WRITE_HALF) ? 2 : 4;
+    mask = (MEMORY_SIZE - 1) & ~(size - 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<accesses; i++) {
+        switch (access) {
+          case READ_BYTE:
+            memory_read_byte(m, address, &byte);
+            sum += byte;
+            break;
+          case READ_HALF:
+            memory_read_half(m, address, &half);
+            sum += half;
+            break;
+          case READ_WORD:
+            memory_read_word(m, address, &word);
+            sum += word;
+            break;
+          case WRITE_BYTE:
+            memory_write_byte(m, address, i);
+            break;
+          case WRITE_HALF:
+            memory_write_half(m, address, i);
+            break;
+          case WRITE_WORD:
+            memory_write_word(m, address, i);
+            break;
+        }
+        address = (address + size) & mask;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sink = sum;
+    return accesses / ((end.tv_sec - start.tv_sec) +
+                       (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    char *endianess[] = { "little", "big" };
+    long accesses = DEFAULT_ACCESSES;
+    memory m;
+    int i, access;
+
+    if (argc > 1)
+        accesses = atol(argv[1]);
+
+    printf("I'm a %s endian host\n", endianess[is_big_endian()]);
+    for (i=0; i<2; i++) {
+        m = memory_create(MEMORY_SIZE, i);
+        if (m == NULL) {
+            fprintf(stderr, "Error when creating simulated memory\n");
+            exit(1);
+        }
+        /* Fills the memory once, so that page faults are not measured */
+        measure(m, WRITE_WORD, MEMORY_SIZE / 4);
+        printf("%s endian simulated memory :\n", endianess[i]);
+        for (access=READ_BYTE; access<=WRITE_WORD; access++)
+            printf("- %s, %.1f millions per second\n", access_names[access],
+                   measure(m, access, accesses) / 1e6);
+        memory_destroy(m);
+    }
+    return 0;
+}
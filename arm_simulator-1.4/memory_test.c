@@ -32,6 +32,37 @@ void print_test(int result) {
         printf("TEST FAILED !!\n");
 }
 
+void count_watch(void *data, uint32_t address) {
+    (*(int *) data)++;
+}
+
+/* Device whose only register, at offset 4, counts the reads and keeps the
+ * last value written
+ */
+int device_register;
+
+int device_read(void *data, uint32_t offset, int size, uint32_t *value) {
+    if (offset != 4)
+        return -1;
+    *value = device_register++;
+    return 0;
+}
+
+int device_write(void *data, uint32_t offset, int size, uint32_t value) {
+    if (offset != 4)
+        return -1;
+    device_register = value;
+    return 0;
+}
+
+const struct memory_device_ops device_ops = {
+    device_read, device_write, NULL, MEMORY_DEVICE_WORD
+};
+
+void add_dirty(void *data, uint32_t address) {
+    *(uint32_t *) data += address;
+}
+
 int compare(void *a, void *b, size_t size, int reverse) {
     int i, j, j_step;
 
@@ -70,10 +101,17 @@ int compare_with_sim(void *a, memory m, size_t size, int reverse) {
 int main() {
     char *endianess[] = { "little", "big" };
     memory m[2];
-    uint32_t word_value = 0x11223344, word_read;
+    uint32_t word_value = 0x11223344, word_read, other_word_read;
+    uint32_t block_value[2] = { 0x11223344, 0x55667788 };
     uint16_t half_value = 0x5566, half_read;
-    uint8_t *position;
-    int i;
+    uint8_t *position, byte_read;
+    uint8_t byte_block[4] = { 0x11, 0x22, 0x33, 0x44 }, byte_block_read[4];
+    const uint8_t *span;
+    uint8_t *write_span;
+    size_t length;
+    FILE *file;
+    memory_tlb tlb;
+    int i, watch_count = 0;
 
     m[1] = memory_create(4,1);
     m[0] = memory_create(4,0);
@@ -119,5 +157,222 @@ int main() {
     memory_write_half(m[1-is_big_endian()], 0, half_value);
     print_test(compare_with_sim(&half_value, m[1-is_big_endian()], 2, 1));
 
+    printf("Writing and reading blocks of words, which should behave as "
+           "the same accesses made one word at a time :\n");
+    for (i=0; i<2; i++) {
+        printf("- block write in %s endian memory, ", endianess[i]);
+        memory_write_word(m[i], 0, 0);
+        memory_write_words(m[i], 0, &word_value, 1);
+        memory_read_word(m[i], 0, &word_read);
+        print_test(word_read == word_value);
+        printf("- block read in %s endian memory, ", endianess[i]);
+        word_read = 0;
+        memory_read_words(m[i], 0, &word_read, 1);
+        print_test(word_read == word_value);
+        printf("- block partly out of %s endian memory, ", endianess[i]);
+        memory_write_word(m[i], 0, 0);
+        print_test((memory_write_words(m[i], 0, block_value, 2) == -1) &&
+                   (memory_read_words(m[i], 0, block_value, 2) == -1) &&
+                   (memory_read_word(m[i], 0, &word_read) == 0) &&
+                   (word_read == 0));
+    }
+
+    printf("Accessing a memory covering the whole address space, pages "
+           "being allocated when first written :\n");
+    m[0] = memory_create(MEMORY_FULL_SIZE, 0);
+    if (m[0] == NULL) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    printf("- never written word reads as zero, ");
+    word_read = 1;
+    print_test((memory_read_word(m[0], 0x80000000, &word_read) == 0) &&
+               (word_read == 0));
+    printf("- word at the end of the address space, ");
+    memory_write_word(m[0], 0xFFFFFFFC, word_value);
+    memory_read_word(m[0], 0xFFFFFFFC, &word_read);
+    print_test(word_read == word_value);
+    printf("- word crossing the end of the address space, ");
+    print_test((memory_write_word(m[0], 0xFFFFFFFE, word_value) == -1) &&
+               (memory_read_word(m[0], 0xFFFFFFFE, &word_read) == -1));
+    printf("- word crossing a page boundary, ");
+    memory_write_word(m[0], 0x1FFE, word_value);
+    memory_read_word(m[0], 0x1FFE, &word_read);
+    print_test(word_read == word_value);
+    printf("- block crossing a page boundary, ");
+    memory_write_words(m[0], 0x2FFC, block_value, 2);
+    memory_read_word(m[0], 0x3000, &word_read);
+    print_test(word_read == block_value[1]);
+    printf("- block of bytes crossing a page boundary, ");
+    memory_write_block(m[0], 0x4FFE, byte_block, 4);
+    print_test((memory_read_block(m[0], 0x4FFE, byte_block_read, 4) == 0) &&
+               compare(byte_block, byte_block_read, 4, 0) &&
+               (memory_read_byte(m[0], 0x5000, &byte_read) == 0) &&
+               (byte_read == byte_block[2]) &&
+               (memory_write_block(m[0], 0xFFFFFFFE, byte_block, 4) == -1));
+    printf("- spans borrowed to read and write in place, ");
+    span = memory_read_span(m[0], 0x4FFE, 4, &length);
+    write_span = memory_write_span(m[0], 0x6000, 4, &length);
+    memcpy(write_span, byte_block, length);
+    print_test((span != NULL) && (span[1] == byte_block[1]) &&
+               (write_span != NULL) && (length == 4) &&
+               (memory_read_block(m[0], 0x6000, byte_block_read, 4) == 0) &&
+               compare(byte_block, byte_block_read, 4, 0) &&
+               (memory_read_span(m[0], 0x4FFE, 4, &length) == span) &&
+               (length >= 2) && (length <= 4));
+    printf("- empty blocks leaving their page never written, ");
+    print_test((memory_write_block(m[0], 0x7000, byte_block, 0) == 0) &&
+               (memory_read_block(m[0], 0x7000, byte_block_read, 0) == 0) &&
+               (memory_read_span(m[0], 0x7000, 1, &length) ==
+                memory_read_span(m[0], 0x80000000, 1, &length)));
+    printf("- file mapped copy-on-write, ");
+    file = tmpfile();
+    for (i=0; i<2*(1 << MEMORY_PAGE_SHIFT); i++)
+        fputc(i, file);
+    fflush(file);
+    memory_map_file(m[0], 0x10000, fileno(file), 0, 2*(1 << MEMORY_PAGE_SHIFT));
+    memory_read_byte(m[0], 0x11005, &byte_read);
+    memory_write_word(m[0], 0x10004, word_value);
+    rewind(file);
+    print_test((byte_read == 5) && (fgetc(file) == 0) &&
+               (fseek(file, 4, SEEK_SET) == 0) && (fgetc(file) == 4));
+    fclose(file);
+
+    printf("Accessing the memory through the TLB, which should notice the "
+           "changes made to the pages :\n");
+    printf("- unaligned half and word at address 1 of a fresh memory, ");
+    memory_destroy(m[1]);
+    m[1] = memory_create(MEMORY_FULL_SIZE, 1);
+    tlb = memory_get_tlb(m[1]);
+    print_test((memory_tlb_write_half(tlb, m[1], 1, half_value) == 0) &&
+               (memory_tlb_read_half(tlb, m[1], 1, &half_read) == 0) &&
+               (half_read == half_value) &&
+               (memory_tlb_write_word(tlb, m[1], 1, word_value) == 0) &&
+               (memory_tlb_read_word(tlb, m[1], 1, &word_read) == 0) &&
+               (word_read == word_value) &&
+               (memory_read_byte(m[1], 1, &byte_read) == 0) &&
+               (byte_read == 0x11));
+    memory_destroy(m[1]);
+    tlb = memory_get_tlb(m[0]);
+    printf("- word read, then written without the TLB, ");
+    memory_tlb_read_word(tlb, m[0], 0x20000, &word_read);
+    memory_write_word(m[0], 0x20000, word_value);
+    memory_tlb_read_word(tlb, m[0], 0x20000, &word_read);
+    print_test(word_read == word_value);
+    printf("- word written, then the page watched, ");
+    memory_set_watch_handler(m[0], count_watch, &watch_count);
+    memory_tlb_write_word(tlb, m[0], 0x20000, 0);
+    memory_watch_page(m[0], 0x20000);
+    memory_tlb_write_word(tlb, m[0], 0x20000, word_value);
+    memory_tlb_write_word(tlb, m[0], 0x20004, word_value);
+    memory_read_word(m[0], 0x20000, &word_read);
+    print_test((watch_count == 1) && (word_read == word_value));
+    printf("- word crossing a page boundary, ");
+    memory_tlb_write_word(tlb, m[0], 0x20FFE, word_value);
+    memory_read_word(m[0], 0x20FFE, &word_read);
+    print_test(word_read == word_value);
+
+    printf("Accessing a memory mapped device, which should get the accesses "
+           "made to its pages instead of the memory :\n");
+    printf("- device over a page read through the TLB, ");
+    memory_tlb_read_word(tlb, m[0], 0x30004, &word_read);
+    print_test((memory_add_device(m[0], 0x30000, 1 << MEMORY_PAGE_SHIFT,
+                                  &device_ops, NULL) == 0) &&
+               (memory_add_device(m[0], 0x30000, 1 << MEMORY_PAGE_SHIFT,
+                                  &device_ops, NULL) == -1) &&
+               (memory_add_device(m[0], 0x40004, 1 << MEMORY_PAGE_SHIFT,
+                                  &device_ops, NULL) == -1));
+    printf("- word written then read twice, ");
+    memory_tlb_write_word(tlb, m[0], 0x30004, word_value);
+    memory_tlb_read_word(tlb, m[0], 0x30004, &word_read);
+    memory_read_word(m[0], 0x30004, &word_read);
+    print_test((word_read == word_value + 1) &&
+               (memory_get_device_accesses(m[0]) == 3));
+    printf("- accesses refused, ");
+    print_test((memory_read_byte(m[0], 0x30004, &byte_read) == -1) &&
+               (memory_read_word(m[0], 0x30008, &word_read) == -1) &&
+               (memory_write_word(m[0], 0x2FFFE, 0) == -1) &&
+               (memory_read_words(m[0], 0x30000, block_value, 2) == -1) &&
+               (memory_map_file(m[0], 0x30000, 0, 0, 1) == -1) &&
+               (memory_read_block(m[0], 0x2FFFC, byte_block_read, 8) == -1) &&
+               (memory_read_span(m[0], 0x30000, 4, &length) == NULL) &&
+               (memory_write_span(m[0], 0x30000, 4, &length) == NULL));
+    printf("- block of words, ");
+    print_test((memory_read_words(m[0], 0x30004, block_value, 1) == 0) &&
+               (block_value[0] == word_value + 2));
+
+    printf("Tracking the pages written, through the TLB or not :\n");
+    printf("- pages dirty after the tests above, ");
+    word_read = 0;
+    print_test(memory_is_dirty(m[0], 0xFFFFFFFF) &&
+               !memory_is_dirty(m[0], 0x80000000) &&
+               (memory_for_each_dirty(m[0], 0x20000, 0x20000, add_dirty,
+                                      &word_read) == 2) &&
+               (word_read == 0x20000 + 0x21000));
+    printf("- pages cleared then written again, ");
+    memory_clear_dirty(m[0], 0, MEMORY_FULL_SIZE);
+    memory_tlb_write_word(tlb, m[0], 0x20000, word_value);
+    memory_write_word(m[0], 0x1FFFE, word_value);
+    memory_write_word(m[0], 0x30004, word_value);
+    word_read = 0;
+    print_test((memory_for_each_dirty(m[0], 0, MEMORY_FULL_SIZE, add_dirty,
+                                      &word_read) == 2) &&
+               (word_read == 0x1F000 + 0x20000) &&
+               (memory_clear_dirty(m[0], 0x1F000, 1) == 1) &&
+               !memory_is_dirty(m[0], 0x1F000) &&
+               memory_is_dirty(m[0], 0x20000));
+
+    printf("Restoring a snapshot of the memory, which should undo the "
+           "writes made since :\n");
+    printf("- written pages restored twice, ");
+    memory_write_word(m[0], 0x20000, word_value);
+    i = memory_snapshot(m[0]);
+    memory_tlb_write_word(tlb, m[0], 0x20000, 0);
+    memory_write_word(m[0], 0x50000, word_value);
+    memory_restore(m[0], i);
+    memory_read_word(m[0], 0x20000, &word_read);
+    memory_read_word(m[0], 0x50000, &other_word_read);
+    memory_tlb_write_word(tlb, m[0], 0x20000, 0);
+    print_test((word_read == word_value) && (other_word_read == 0) &&
+               (memory_restore(m[0], i) == 0) &&
+               (memory_read_word(m[0], 0x20000, &word_read) == 0) &&
+               (word_read == word_value));
+    printf("- older snapshot refused, ");
+    print_test((memory_restore(m[0], memory_snapshot(m[0]) - 1) == -1) &&
+               (memory_restore(m[0], 0) == -1));
+    memory_destroy(m[0]);
+
+    printf("Creating a memory reserved at once in an anonymous mapping "
+           "with transparent huge pages :\n");
+    m[0] = memory_create_backed(MEMORY_FULL_SIZE, 0, MEMORY_HUGE);
+    printf("- created, ");
+    print_test(m[0] != NULL);
+    if (m[0] != NULL) {
+        printf("- never written page read as zeros, written page read back, ");
+        memory_read_word(m[0], 0x80000000, &word_read);
+        memory_write_word(m[0], 0xFFFFFFFC, word_value);
+        memory_read_word(m[0], 0xFFFFFFFC, &other_word_read);
+        print_test((word_read == 0) && (other_word_read == word_value));
+        printf("- span borrowed over contiguous pages, ");
+        write_span = memory_write_span(m[0], 0x40000, 2*MEMORY_PAGE_SIZE,
+                                       &length);
+        memset(write_span, 0x55, length);
+        print_test((write_span != NULL) && (length == 2*MEMORY_PAGE_SIZE) &&
+                   (memory_read_byte(m[0], 0x41FFF, &byte_read) == 0) &&
+                   (byte_read == 0x55) && memory_is_dirty(m[0], 0x41000));
+        printf("- file mapped over written pages, ");
+        memory_write_word(m[0], 0x30000, 0);
+        file = tmpfile();
+        for (i=0; i<2*MEMORY_PAGE_SIZE; i++)
+            fputc(i, file);
+        fflush(file);
+        print_test((memory_map_file(m[0], 0x30000, fileno(file), 0,
+                                    2*MEMORY_PAGE_SIZE) == 0) &&
+                   (memory_read_byte(m[0], 0x31001, &byte_read) == 0) &&
+                   (byte_read == 1));
+        memory_destroy(m[0]);
+        fclose(file);
+    }
+
     return 0;
 }
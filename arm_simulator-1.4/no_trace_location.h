@@ -23,6 +23,12 @@ Contact: Guillaume.Huard@imag.fr
 #ifdef arm_fetch
 #undef arm_fetch
 #endif
+#ifdef arm_fetch_decoded
+#undef arm_fetch_decoded
+#endif
+#ifdef arm_fetch_predecoded
+#undef arm_fetch_predecoded
+#endif
 #ifdef arm_read_register
 #undef arm_read_register
 #endif
@@ -65,3 +71,9 @@ Contact: Guillaume.Huard@imag.fr
 #ifdef arm_write_word
 #undef arm_write_word
 #endif
+#ifdef arm_read_words
+#undef arm_read_words
+#endif
+#ifdef arm_write_words
+#undef arm_write_words
+#endif
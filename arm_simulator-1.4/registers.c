@@ -98,6 +98,10 @@ void registers_destroy(registers r) {
     free(r);
 }
 
+void registers_copy(registers to, registers from) {
+    *to = *from;
+}
+
 uint8_t is_valid(uint8_t reg) {
 	return reg >= 0 && reg <= 15;
 }
@@ -158,3 +162,13 @@ void write_spsr(registers r, uint32_t value) {
 	init();
 	r->registers[arm_mode_register[((get_mode(r)-16) << 5)|17]] = value; // accès avec "get_mode(r)-16" : voir ligne 125
 }
+
+uint32_t *registers_storage(registers r) {
+	return r->registers;
+}
+
+int registers_index(registers r, uint8_t reg) {
+	if(reg == CPSR) return CPSR;
+	init();
+	return arm_mode_register[((get_mode(r)-16) << 5)|reg];
+}
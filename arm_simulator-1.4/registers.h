@@ -28,6 +28,8 @@ typedef struct registers_data *registers;
 
 registers registers_create();
 void registers_destroy(registers r);
+/* Copies the registers of all the modes, see arm_core_snapshot */
+void registers_copy(registers to, registers from);
 
 uint8_t get_mode(registers r);
 int current_mode_has_spsr(registers r);
@@ -42,4 +44,10 @@ void write_usr_register(registers r, uint8_t reg, uint32_t value);
 void write_cpsr(registers r, uint32_t value);
 void write_spsr(registers r, uint32_t value);
 
+/* Direct access to the register file, for code that computes the location of
+ * registers once (reg is 0 to 15, or 16 for the cpsr), see arm_jit.c
+ */
+uint32_t *registers_storage(registers r);
+int registers_index(registers r, uint8_t reg);
+
 #endif
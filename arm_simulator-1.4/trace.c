@@ -31,10 +31,15 @@ static FILE *output;
  */
 static uint32_t last_address = 0x12345678;
 static int enabled = 1;
-static char *location_file_stack[128];
-static int location_line_stack[128];
-static int location_stack_top = -1;
+/* Positions deeper than the stack are counted but not kept, the deepest kept
+ * one is printed instead
+ */
+#define LOCATION_STACK_SIZE 16
+static char *location_file_stack[LOCATION_STACK_SIZE];
+static int location_line_stack[LOCATION_STACK_SIZE];
+static int location_depth = 0;
 static int trace_flags = 0;
+int trace_active_flags = 0;
 
 #ifdef ARM_TRACE_FORMAT
 static char *trace_memory_seq[] = { "N", "S" };
@@ -53,33 +58,35 @@ void set_trace_file(FILE *f) {
 }
 
 void trace_start_location(char *file, int line) {
-    if (enabled) {
-        location_stack_top++;
-        location_file_stack[location_stack_top] = file;
-        location_line_stack[location_stack_top] = line;
+    if (location_depth < LOCATION_STACK_SIZE) {
+        location_file_stack[location_depth] = file;
+        location_line_stack[location_depth] = line;
     }
+    location_depth++;
 }
 
-uint8_t trace_end_location() {
-    if (enabled) {
-        location_stack_top--;
-    }
-    return 0;
+uint32_t trace_end_location(uint32_t value) {
+    if (location_depth > 0)
+        location_depth--;
+    return value;
 }
 
 #ifndef ARM_TRACE_FORMAT
 static void trace_print_location() {
     if (enabled && (trace_flags & POSITION)) {
-        if (location_stack_top >= 0) {
-            fprintf(output, "%s, %d: ", location_file_stack[location_stack_top],
-                    location_line_stack[location_stack_top]);
+        if (location_depth > 0) {
+            int top = (location_depth < LOCATION_STACK_SIZE ?
+                       location_depth : LOCATION_STACK_SIZE) - 1;
+
+            fprintf(output, "%s, %d: ", location_file_stack[top],
+                    location_line_stack[top]);
         }
     }
 }
 #endif
 
-void trace_memory(uint32_t cycle, uint8_t type, uint8_t size,
-                    uint8_t cause, uint32_t address, uint32_t value) {
+void trace_memory_access(uint32_t cycle, uint8_t type, uint8_t size,
+                         uint8_t cause, uint32_t address, uint32_t value) {
     if (enabled && (trace_flags & MEMORY)) {
         uint8_t seq;
 
@@ -99,8 +106,8 @@ void trace_memory(uint32_t cycle, uint8_t type, uint8_t size,
     }
 }
 
-void trace_register(uint32_t cycle, uint8_t type, uint8_t reg,
-                      uint8_t mode, uint32_t value) {
+void trace_register_access(uint32_t cycle, uint8_t type, uint8_t reg,
+                           uint8_t mode, uint32_t value) {
     if (enabled && (trace_flags & REGISTERS)) {
         char mode_name[5] = "";
         if (arm_get_mode_name(mode)) {
@@ -128,12 +135,16 @@ void trace_arm_state(arm_core p) {
 
 void trace_disable() {
     enabled = 0;
+    trace_active_flags = 0;
 }
 
 void trace_enable() {
     enabled = 1;
+    trace_active_flags = trace_flags;
 }
 
 void trace_add(int flags) {
     trace_flags |= flags;
+    if (enabled)
+        trace_active_flags = trace_flags;
 }
@@ -40,16 +40,41 @@ Contact: Guillaume.Huard@imag.fr
 #define STATE     4
 #define POSITION  8
 
+/* Flags of the traces currently produced: those given to trace_add, or 0
+ * while tracing is disabled. It is only written by the functions below.
+ */
+extern int trace_active_flags;
+
 void set_trace_file(FILE *f);
+/* Positions form a stack, the innermost one is printed with the traces.
+ * trace_end_location pops it and returns its argument, so that it can be
+ * called on the result of the located access.
+ */
 void trace_start_location(char *file, int line);
-uint8_t trace_end_location();
-void trace_memory(uint32_t cycle, uint8_t type, uint8_t size,
-                  uint8_t cause, uint32_t address, uint32_t value);
-void trace_register(uint32_t cycle, uint8_t type, uint8_t reg,
-                    uint8_t mode, uint32_t value);
+uint32_t trace_end_location(uint32_t value);
+void trace_memory_access(uint32_t cycle, uint8_t type, uint8_t size,
+                         uint8_t cause, uint32_t address, uint32_t value);
+void trace_register_access(uint32_t cycle, uint8_t type, uint8_t reg,
+                           uint8_t mode, uint32_t value);
 void trace_arm_state(arm_core p);
 void trace_disable();
 void trace_enable();
 void trace_add(int flags);
 
+/* These are called for every access made by the simulated processor: when
+ * the corresponding trace is off, they only cost a test and their arguments
+ * (such as the mode of a register) are not even evaluated.
+ */
+#define trace_has(flags) (trace_active_flags & (flags))
+#define trace_memory(cycle, type, size, cause, address, value) \
+    do { \
+        if (trace_has(MEMORY)) \
+            trace_memory_access(cycle, type, size, cause, address, value); \
+    } while (0)
+#define trace_register(cycle, type, reg, mode, value) \
+    do { \
+        if (trace_has(REGISTERS)) \
+            trace_register_access(cycle, type, reg, mode, value); \
+    } while (0)
+
 #endif
@@ -24,35 +24,47 @@ Contact: Guillaume.Huard@imag.fr
 #define __TRACE_LOCATION_H__
 #include "trace.h"
 
-#define LOCATION trace_start_location(__FILE__, __LINE__)
-#define END_LOCATION trace_end_location(__FILE__, __LINE__)
+/* Each access to the processor state made by the instructions records its
+ * position in the sources, printed with the trace when POSITION tracing is on.
+ * Otherwise the access is made directly, for the cost of testing the flag.
+ * Accesses that return nothing evaluate to 0, some instructions rely on it.
+ */
+#define LOCATED(type, call) \
+    (trace_has(POSITION) ? \
+     (trace_start_location(__FILE__, __LINE__), \
+      (type) trace_end_location(call)) : \
+     (call))
+#define LOCATED_VOID(call) \
+    (trace_has(POSITION) ? \
+     (trace_start_location(__FILE__, __LINE__), (call), \
+      (uint8_t) trace_end_location(0)) : \
+     ((call), (uint8_t) 0))
 
-#define arm_fetch(p, ins) (LOCATION, arm_fetch(p, ins)+END_LOCATION)
+#define arm_fetch(p, ins) LOCATED(int, arm_fetch(p, ins))
+#define arm_fetch_decoded(p, d) LOCATED(int, arm_fetch_decoded(p, d))
+#define arm_fetch_predecoded(p, d) LOCATED_VOID(arm_fetch_predecoded(p, d))
 
-#define arm_read_register(p, reg) (LOCATION, \
-                                        arm_read_register(p, reg)+END_LOCATION)
-#define arm_read_usr_register(p, reg) (LOCATION, \
-                                    arm_read_usr_register(p, reg)+END_LOCATION)
-#define arm_read_cpsr(p) (LOCATION, arm_read_cpsr(p)+END_LOCATION)
-#define arm_read_spsr(p) (LOCATION, arm_read_spsr(p)+END_LOCATION)
+#define arm_read_register(p, reg) LOCATED(uint32_t, arm_read_register(p, reg))
+#define arm_read_usr_register(p, reg) \
+                             LOCATED(uint32_t, arm_read_usr_register(p, reg))
+#define arm_read_cpsr(p) LOCATED(uint32_t, arm_read_cpsr(p))
+#define arm_read_spsr(p) LOCATED(uint32_t, arm_read_spsr(p))
 #define arm_write_register(p, reg, val) \
-                      (LOCATION, arm_write_register(p, reg, val), END_LOCATION)
+                                LOCATED_VOID(arm_write_register(p, reg, val))
 #define arm_write_usr_register(p, reg, val) \
-                  (LOCATION, arm_write_usr_register(p, reg, val), END_LOCATION)
-#define arm_write_cpsr(p, val) (LOCATION, arm_write_cpsr(p, val), END_LOCATION)
-#define arm_write_spsr(p, val) (LOCATION, arm_write_spsr(p, val), END_LOCATION)
-
-#define arm_read_byte(p, addr, val) (LOCATION, \
-                                      arm_read_byte(p, addr, val)+END_LOCATION)
-#define arm_read_half(p, addr, val) (LOCATION, \
-                                      arm_read_half(p, addr, val)+END_LOCATION)
-#define arm_read_word(p, addr, val) (LOCATION, \
-                                      arm_read_word(p, addr, val)+END_LOCATION)
-#define arm_write_byte(p, addr, val) (LOCATION, \
-                                     arm_write_byte(p, addr, val)+END_LOCATION)
-#define arm_write_half(p, addr, val) (LOCATION, \
-                                     arm_write_half(p, addr, val)+END_LOCATION)
-#define arm_write_word(p, addr, val) (LOCATION, \
-                                     arm_write_word(p, addr, val)+END_LOCATION)
+                            LOCATED_VOID(arm_write_usr_register(p, reg, val))
+#define arm_write_cpsr(p, val) LOCATED_VOID(arm_write_cpsr(p, val))
+#define arm_write_spsr(p, val) LOCATED_VOID(arm_write_spsr(p, val))
+
+#define arm_read_byte(p, addr, val) LOCATED(int, arm_read_byte(p, addr, val))
+#define arm_read_half(p, addr, val) LOCATED(int, arm_read_half(p, addr, val))
+#define arm_read_word(p, addr, val) LOCATED(int, arm_read_word(p, addr, val))
+#define arm_write_byte(p, addr, val) LOCATED(int, arm_write_byte(p, addr, val))
+#define arm_write_half(p, addr, val) LOCATED(int, arm_write_half(p, addr, val))
+#define arm_write_word(p, addr, val) LOCATED(int, arm_write_word(p, addr, val))
+#define arm_read_words(p, addr, val, n) \
+                              LOCATED(int, arm_read_words(p, addr, val, n))
+#define arm_write_words(p, addr, val, n) \
+                              LOCATED(int, arm_write_words(p, addr, val, n))
 
 #endif